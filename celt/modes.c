@@ -221,10 +221,34 @@ static void compute_allocation_table(CELTMode *mode)
 
 #endif /* CUSTOM_MODES */
 
-CELTMode *opus_custom_mode_create(opus_int32 Fs, int frame_size, int *error)
+const CELTMode *celt_static_mode(opus_int32 Fs, int frame_size)
 {
+#ifndef CUSTOM_MODES_ONLY
    int i;
+   for (i=0;i<TOTAL_MODES;i++)
+   {
+      int j;
+      for (j=0;j<4;j++)
+      {
+         if (Fs == static_mode_list[i]->Fs &&
+               (frame_size<<j) == static_mode_list[i]->shortMdctSize*static_mode_list[i]->nbShortMdcts)
+            return static_mode_list[i];
+      }
+   }
+#else
+   (void)Fs;
+   (void)frame_size;
+#endif /* CUSTOM_MODES_ONLY */
+   return NULL;
+}
+
+CELTMode *opus_custom_mode_create(opus_int32 Fs, int frame_size, int *error)
+{
+#ifndef CUSTOM_MODES_ONLY
+   const CELTMode *static_mode;
+#endif
 #ifdef CUSTOM_MODES
+   int i;
    CELTMode *mode=NULL;
    int res;
    opus_val16 *window;
@@ -239,19 +263,12 @@ CELTMode *opus_custom_mode_create(opus_int32 Fs, int frame_size, int *error)
 #endif
 
 #ifndef CUSTOM_MODES_ONLY
-   for (i=0;i<TOTAL_MODES;i++)
+   static_mode = celt_static_mode(Fs, frame_size);
+   if (static_mode != NULL)
    {
-      int j;
-      for (j=0;j<4;j++)
-      {
-         if (Fs == static_mode_list[i]->Fs &&
-               (frame_size<<j) == static_mode_list[i]->shortMdctSize*static_mode_list[i]->nbShortMdcts)
-         {
-            if (error)
-               *error = OPUS_OK;
-            return (CELTMode*)static_mode_list[i];
-         }
-      }
+      if (error)
+         *error = OPUS_OK;
+      return (CELTMode*)static_mode;
    }
 #endif /* CUSTOM_MODES_ONLY */
 
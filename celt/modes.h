@@ -71,5 +71,15 @@ struct OpusCustomMode {
    PulseCache cache;
 };
 
+/** Compiled-in mode of this rate and frame size (or a frame size 2, 4 or 8
+ * times shorter), NULL if there is none.
+ *
+ * The static modes, including their MDCT and FFT setups, are constant data
+ * shared by the whole process: they are never allocated or freed and can be
+ * used from any number of threads at the same time without locking.
+ * Unlike opus_custom_mode_create(), this never creates a custom mode.
+ */
+const CELTMode *celt_static_mode(opus_int32 Fs, int frame_size);
+
 
 #endif
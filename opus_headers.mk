@@ -6,4 +6,6 @@ src/opus_private.h \
 src/analysis.h \
 src/mapping_matrix.h \
 src/mlp.h \
+src/x86/analysis_sse.h \
+src/x86/mlp_sse.h \
 src/tansig_table.h
@@ -13,3 +13,8 @@ OPUS_SOURCES_FLOAT = \
 src/analysis.c \
 src/mlp.c \
 src/mlp_data.c
+
+OPUS_SOURCES_FLOAT_SSE4_1 = \
+src/x86/x86_analysis_map.c \
+src/x86/analysis_sse4_1.c \
+src/x86/mlp_sse4_1.c
@@ -0,0 +1,118 @@
+#!/usr/bin/python3
+#
+# Write the weights of the analysis network as a binary model file for
+# opus_sm_demo -n and sm_model_load() (format in sm/opus_sm_model.h).
+#
+# The weights come either from a Keras model trained by rnn_train.py
+# (weights.hdf5 by default), quantized to int8 like the compiled-in ones,
+# or from a generated C file such as src/mlp_data.c (--c), which gives a
+# file identical to the compiled-in network.
+#
+# Usage: dump_rnn_bin.py [--keras weights.hdf5 | --c src/mlp_data.c] out.bin
+
+from __future__ import print_function
+
+import argparse
+import re
+import struct
+import sys
+import zlib
+
+MAGIC = b'SMNN'
+VERSION = 1
+LAYER_DENSE = 0
+LAYER_GRU = 1
+NUM_FEATURES = 25
+NUM_OUTPUTS = 2
+MAX_NEURONS = 32
+
+
+def quantize(values):
+    """Keras weights to WEIGHTS_SCALE (1/128) int8 units"""
+    return [max(-128, min(127, int(round(128*v)))) for v in values]
+
+
+def from_keras(path):
+    from keras.models import load_model
+    from keras import backend as K
+    import numpy as np
+
+    def binary_crossentrop2(y_true, y_pred):
+        return K.mean(2*K.abs(y_true-0.5) * K.binary_crossentropy(y_pred, y_true), axis=-1)
+
+    model = load_model(path, custom_objects={'binary_crossentrop2': binary_crossentrop2})
+    w = [np.reshape(v, (-1)) for v in model.get_weights()]
+    dense0, gru, dense1 = [layer for layer in model.layers if layer.get_weights()]
+    layers = [
+        (LAYER_DENSE, dense0.get_config()['activation'] == 'sigmoid', NUM_FEATURES, dense0.units,
+         [quantize(w[1]), quantize(w[0])]),
+        (LAYER_GRU, 0, dense0.units, gru.units,
+         [quantize(w[4]), quantize(w[2]), quantize(w[3])]),
+        (LAYER_DENSE, dense1.get_config()['activation'] == 'sigmoid', gru.units, dense1.units,
+         [quantize(w[6]), quantize(w[5])]),
+    ]
+    return layers
+
+
+def from_c(path):
+    src = open(path).read()
+    arrays = {}
+    for name, body in re.findall(r'opus_int8\s+(\w+)\s*\[\d*\]\s*=\s*\{([^}]*)\}', src):
+        arrays[name] = [int(v) for v in body.replace('\n', ' ').split(',') if v.strip()]
+    structs = {}
+    for kind, name, body in re.findall(r'const\s+(DenseLayer|GRULayer)\s+(\w+)\s*=\s*\{([^}]*)\}', src):
+        structs[name] = (kind, [v.strip() for v in body.split(',')])
+
+    def dense(name):
+        kind, f = structs[name]
+        assert kind == 'DenseLayer'
+        return (LAYER_DENSE, int(f[4]), int(f[2]), int(f[3]), [arrays[f[0]], arrays[f[1]]])
+
+    def gru(name):
+        kind, f = structs[name]
+        assert kind == 'GRULayer'
+        return (LAYER_GRU, 0, int(f[3]), int(f[4]), [arrays[f[0]], arrays[f[1]], arrays[f[2]]])
+
+    return [dense('layer0'), gru('layer1'), dense('layer2')]
+
+
+def check(layers):
+    for i, (kind, sigmoid, nb_inputs, nb_neurons, arrays) in enumerate(layers):
+        if not (0 < nb_inputs <= MAX_NEURONS and 0 < nb_neurons <= MAX_NEURONS):
+            sys.exit('layer {}: {}x{} is larger than MAX_NEURONS ({})'.format(i, nb_inputs, nb_neurons, MAX_NEURONS))
+        columns = (3 if kind == LAYER_GRU else 1)*nb_neurons
+        sizes = [columns, nb_inputs*columns] + ([nb_neurons*columns] if kind == LAYER_GRU else [])
+        if [len(a) for a in arrays] != sizes:
+            sys.exit('layer {}: weights do not match a {}x{} layer'.format(i, nb_inputs, nb_neurons))
+        if i > 0 and nb_inputs != layers[i-1][3]:
+            sys.exit('layer {}: {} inputs after {} neurons'.format(i, nb_inputs, layers[i-1][3]))
+    if layers[0][2] != NUM_FEATURES or layers[-1][3] != NUM_OUTPUTS:
+        sys.exit('the network must have {} inputs and {} outputs'.format(NUM_FEATURES, NUM_OUTPUTS))
+
+
+def serialize(layers):
+    payload = b''
+    for kind, sigmoid, nb_inputs, nb_neurons, arrays in layers:
+        payload += struct.pack('<BBHHH', kind, int(sigmoid), nb_inputs, nb_neurons, 0)
+        weights = b''.join(struct.pack('<{}b'.format(len(a)), *a) for a in arrays)
+        payload += weights + b'\0'*((4 - len(weights) % 4) % 4)
+    header = struct.pack('<4sHHII', MAGIC, VERSION, len(layers), len(payload), zlib.adler32(payload) & 0xffffffff)
+    return header + payload
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Export the analysis network as a binary model file')
+    source = parser.add_mutually_exclusive_group()
+    source.add_argument('--keras', default='weights.hdf5', help='Keras model from rnn_train.py')
+    source.add_argument('--c', help='generated C file, e.g. src/mlp_data.c')
+    parser.add_argument('output')
+    args = parser.parse_args()
+
+    layers = from_c(args.c) if args.c else from_keras(args.keras)
+    check(layers)
+    with open(args.output, 'wb') as f:
+        f.write(serialize(layers))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,63 @@
+#!/usr/bin/python3
+#
+# Accuracy and speed of the fast mode (-d) of opus_sm_demo against the full
+# analysis. Every WAVE file is analyzed once in each mode; for each file and
+# decimation the script prints the mean and max absolute music probability
+# difference, the share of frames with the same speech/music decision
+# (pmusic > 0.5), the music ratio of both modes and the speedup.
+#
+# Usage: sm_fast_accuracy.py [--demo ./opus_sm_demo] [--decimation 2,3] file.wav...
+
+from __future__ import print_function
+
+import argparse
+import subprocess
+import sys
+import time
+
+
+def analyze(demo, path, decimation):
+    start = time.time()
+    out = subprocess.run([demo, '-d', str(decimation), path], check=True,
+                         stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                         universal_newlines=True)
+    elapsed = time.time() - start
+    pmusic = []
+    ratio = None
+    for line in out.stdout.splitlines():
+        cols = line.split()
+        if len(cols) == 2:
+            pmusic.append(float(cols[1]))
+    for line in out.stderr.splitlines():
+        if line.startswith('Music ratio:'):
+            ratio = float(line.split()[2])
+    return pmusic, ratio, elapsed
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Fast mode accuracy of opus_sm_demo')
+    parser.add_argument('--demo', default='./opus_sm_demo')
+    parser.add_argument('--decimation', default='2,3')
+    parser.add_argument('files', nargs='+')
+    args = parser.parse_args()
+    decimations = [int(d) for d in args.decimation.split(',')]
+
+    print('{:<32} {:>2} {:>9} {:>9} {:>8} {:>8} {:>8} {:>7}'.format(
+        'file', 'd', 'mean|dp|', 'max|dp|', 'agree', 'ratio', 'ratio d', 'speedup'))
+    for path in args.files:
+        ref, ref_ratio, ref_time = analyze(args.demo, path, 1)
+        if len(ref) == 0:
+            print('{}: no frames'.format(path), file=sys.stderr)
+            continue
+        for d in decimations:
+            fast, ratio, elapsed = analyze(args.demo, path, d)
+            n = min(len(ref), len(fast))
+            diff = [abs(ref[i] - fast[i]) for i in range(n)]
+            agree = sum((ref[i] > 0.5) == (fast[i] > 0.5) for i in range(n)) / float(n)
+            print('{:<32} {:>2} {:>9.4f} {:>9.4f} {:>8.4f} {:>8.4f} {:>8.4f} {:>6.2f}x'.format(
+                path[-32:], d, sum(diff) / n, max(diff), agree,
+                ref_ratio or 0, ratio or 0, ref_time / max(elapsed, 1e-6)))
+
+
+if __name__ == '__main__':
+    main()
@@ -1,6 +1,15 @@
 #include "opus_sm.h"
+#include "opus_sm_pcm.h"
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 
+/* Size of the float buffer of 16 bit input that is mixed (at least one frame) */
+#define SM_CONVERT_SAMPLES 16384
+
+static void start_workers(OpusSM* sm);
+static void stop_workers(OpusSM* sm);
 
 int sm_error(OpusSM* sm) {
 	if (sm == NULL) return SM_ERR_NULL_HANDLER;
@@ -8,57 +17,635 @@ int sm_error(OpusSM* sm) {
 }
 
 OpusSM* sm_init(int samplerate, int channels)
+{
+	return sm_init_mix(samplerate, channels, SM_DEFAULT_HOP_MS, NULL, 1);
+}
+
+OpusSM* sm_init_hop(int samplerate, int channels, int hop_ms)
+{
+	return sm_init_mix(samplerate, channels, hop_ms, NULL, 1);
+}
+
+/* 48 and 24 kHz are analyzed directly, other rates need a resampler table of a reasonable size */
+static int samplerate_supported(int samplerate) {
+	if ((samplerate < SM_MIN_SAMPLERATE) || (samplerate > SM_MAX_SAMPLERATE)) {
+		return 0;
+	}
+	return (samplerate == SM_SUPPORTED_SAMPLERATE) || (samplerate == SM_ANALYSIS_SAMPLERATE) ||
+	       (rs_filter_size(samplerate, SM_ANALYSIS_SAMPLERATE) <= RS_MAX_FILTER_SIZE);
+}
+
+OpusSM* sm_init_mix(int samplerate, int channels, int hop_ms, const float* matrix, int num_streams)
 {
 	OpusSM* sm = (OpusSM*)malloc(sizeof(OpusSM));
 	sm->error = SM_OK;
-	if (samplerate != SM_SUPPORTED_SAMPLERATE) {
+	sm->streams = NULL;
+	sm->num_streams = 0;
+	sm->matrix = NULL;
+	sm->rnn_state = NULL;
+	sm->num_threads = 1;
+	sm->workers = NULL;
+	sm->decimation = 1;
+	sm->outputs = ANALYSIS_ALL;
+	sm->model = NULL;
+	sm->celt_mode = NULL;
+	sm->converted = NULL;
+	sm->convert_frames = 0;
+	sm->Fs = samplerate;
+	sm->analysis_Fs = samplerate;
+	sm->frame_size = 0;
+	sm->channels = channels;
+	sm->hop_ms = hop_ms;
+	if (!samplerate_supported(samplerate)) {
 		sm->error = SM_ERR_UNSUPPORTED_SAMPLERATE;
-		sm->opus_enc = NULL;
 		return sm;
 	}
-	/* application can be: (see opus_encoder_init() in src/opus_encoder.c)
-	     OPUS_APPLICATION_VOIP
-	     OPUS_APPLICATION_AUDIO
-	     OPUS_APPLICATION_RESTRICTED_LOWDELAY */
-	int error;
-	sm->opus_enc = opus_encoder_create(samplerate, channels, OPUS_APPLICATION_VOIP, &error);
-	if (error != 0) {
-		sm->error = SM_ERR_OPUS_ENC_CREATE_FAILED;
+	if ((hop_ms < SM_MIN_HOP_MS) || (hop_ms > SM_MAX_HOP_MS)) {
+		sm->error = SM_ERR_UNSUPPORTED_HOP;
+		return sm;
+	}
+	if (((opus_int64)samplerate*hop_ms) % 1000 != 0) {
+		sm->error = (hop_ms == SM_DEFAULT_HOP_MS) ? SM_ERR_UNSUPPORTED_SAMPLERATE : SM_ERR_UNSUPPORTED_HOP;
+		return sm;
+	}
+	if ((channels < 1) || (num_streams < 1) || (num_streams > SM_MAX_STREAMS) ||
+	    ((matrix == NULL) && (num_streams != 1) && (num_streams != channels))) {
+		sm->error = SM_ERR_UNSUPPORTED_MIX;
 		return sm;
 	}
+	/* run_analysis() steps through the frame in 20 ms windows, and
+	   tonality_get_info() reports once per frame */
+	sm->frame_size = (int)((opus_int64)samplerate*hop_ms/1000);
+
+	/* The static 48 kHz mode (see celt/static_modes_float.h): all contexts and
+	   threads share one read-only copy of it and of its FFT setup. Unlike
+	   opus_custom_mode_create() this can never allocate a custom mode. */
+	sm->celt_mode = tonality_analysis_mode();
+	if (sm->celt_mode == NULL) {
+		sm->error = SM_ERR_MODE_CREATE_FAILED;
+		return sm;
+	}
+
+	if (matrix != NULL) {
+		sm->matrix = (float*)malloc(sizeof(float)*num_streams*channels);
+		memcpy(sm->matrix, matrix, sizeof(float)*num_streams*channels);
+	}
 
-	sm->celt_enc = (CELTEncoder*)((char*)sm->opus_enc + sm->opus_enc->celt_enc_offset);
-	celt_encoder_ctl(sm->celt_enc, CELT_GET_MODE(&sm->celt_mode));
-	sm->lsb_depth = IMIN(16, sm->opus_enc->lsb_depth);
-	sm->delay_compensation = 0;
-	if (sm->opus_enc->application != OPUS_APPLICATION_RESTRICTED_LOWDELAY) sm->delay_compensation = sm->opus_enc->delay_compensation;
+	/* The analysis itself handles 48 and 24 kHz (its 16 kHz path skips too
+	   much of the spectrum), everything else goes through the resampler */
+	int resample = (samplerate != SM_SUPPORTED_SAMPLERATE) && (samplerate != SM_ANALYSIS_SAMPLERATE);
+	if (resample) {
+		sm->analysis_Fs = SM_ANALYSIS_SAMPLERATE;
+	}
+	/* 16 bit input is mixed in float, converted a few frames at a time */
+	if (resample || (sm->matrix != NULL)) {
+		size_t stride = (size_t)sm->frame_size*channels;
+		sm->convert_frames = (stride < SM_CONVERT_SAMPLES) ? (int)(SM_CONVERT_SAMPLES/stride) : 1;
+		sm->converted = (float*)malloc(sizeof(float)*stride*sm->convert_frames);
+	}
+	sm->streams = (SMStream*)calloc(num_streams, sizeof(SMStream));
+	sm->num_streams = num_streams;
+	/* Multiple streams run the MLP in batches, with their GRU states side by side */
+	if (num_streams > 1) {
+		sm->rnn_state = (float*)calloc((size_t)num_streams*MAX_NEURONS, sizeof(float));
+	}
+	for (int s = 0; s < num_streams; s++) {
+		SMStream* st = &sm->streams[s];
+		if (resample) {
+			st->resampler = rs_init(samplerate, SM_ANALYSIS_SAMPLERATE, sm->frame_size);
+			if (st->resampler == NULL) {
+				sm->error = SM_ERR_UNSUPPORTED_SAMPLERATE;
+				return sm;
+			}
+			st->resampled = (float*)malloc(sizeof(float)*rs_output_size(st->resampler));
+		}
+		if (resample || (sm->matrix != NULL)) {
+			st->mono = (float*)malloc(sizeof(float)*sm->frame_size);
+		}
+
+		/* Same initialization as opus_encoder_init() in src/opus_encoder.c */
+		tonality_analysis_init(&st->analysis, sm->analysis_Fs);
+		st->analysis.application = OPUS_APPLICATION_VOIP;
+		if (sm->rnn_state != NULL) {
+			st->mlp_features = (float*)malloc(sizeof(float)*DETECT_SIZE*MAX_NEURONS);
+			st->analysis.mlp_features = st->mlp_features;
+		}
+		memset(&st->analysis_info, 0, sizeof(AnalysisInfo));
+	}
+	/* The encoder's default lsb_depth is 24, which is capped to 16 for the analysis */
+	sm->lsb_depth = 16;
 	return sm;
 }
 
+int sm_hop_step(int samplerate) {
+	if (!samplerate_supported(samplerate)) {
+		return 0;
+	}
+	/* A whole number of samples in hop_ms: hop_ms a multiple of 1000/gcd(samplerate, 1000) */
+	int a = samplerate;
+	int b = 1000;
+	while (b != 0) {
+		int r = a % b;
+		a = b;
+		b = r;
+	}
+	return 1000/a;
+}
+
+int sm_mix_matrix(const char* name, int channels, float* matrix) {
+	if ((strcmp(name, "midside") == 0) && (channels == 2)) {
+		static const float midside[2*2] = {
+			0.5f,  0.5f,
+			0.5f, -0.5f
+		};
+		if (matrix != NULL) {
+			memcpy(matrix, midside, sizeof(midside));
+		}
+		return 2;
+	}
+	if ((strcmp(name, "stereo") == 0) && (channels == 6)) {
+		/* WAVE channel order FL FR FC LFE BL BR, Lo = L + 0.707 C + 0.707 Ls,
+		   scaled to unity gain like the average of the channels */
+		static const float stereo[2*6] = {
+			0.4142f, 0.f,     0.2929f, 0.f, 0.2929f, 0.f,
+			0.f,     0.4142f, 0.2929f, 0.f, 0.f,     0.2929f
+		};
+		if (matrix != NULL) {
+			memcpy(matrix, stereo, sizeof(stereo));
+		}
+		return 2;
+	}
+	return 0;
+}
+
+void sm_set_threads(OpusSM* sm, int num_threads) {
+	if (sm == NULL) {
+		return;
+	}
+	stop_workers(sm);
+	sm->num_threads = (num_threads < 1) ? 1 : num_threads;
+	if ((sm->error == SM_OK) && (sm->num_threads > 1) && (sm->num_streams > 1)) {
+		start_workers(sm);
+	}
+}
+
+void sm_set_decimation(OpusSM* sm, int decimation) {
+	if (sm == NULL) {
+		return;
+	}
+	sm->decimation = (decimation < 1) ? 1 : (decimation > SM_MAX_DECIMATION) ? SM_MAX_DECIMATION : decimation;
+	for (int s = 0; s < sm->num_streams; s++) {
+		sm->streams[s].analysis.decimation = sm->decimation;
+	}
+}
+
+void sm_set_analysis_outputs(OpusSM* sm, int outputs) {
+	if (sm == NULL) {
+		return;
+	}
+	sm->outputs = outputs & ANALYSIS_ALL;
+	for (int s = 0; s < sm->num_streams; s++) {
+		sm->streams[s].analysis.outputs = sm->outputs;
+	}
+}
+
+void sm_set_model(OpusSM* sm, const SMModel* model) {
+	if (sm == NULL) {
+		return;
+	}
+	sm->model = model;
+	for (int s = 0; s < sm->num_streams; s++) {
+		sm->streams[s].analysis.model = (model != NULL) ? &model->mlp : &mlp_default_model;
+	}
+}
+
+int sm_streams(OpusSM* sm) {
+	if (sm == NULL) {
+		return 0;
+	}
+	return sm->num_streams;
+}
+
+void sm_reset(OpusSM* sm) {
+	if ((sm == NULL) || (sm->error != SM_OK)) {
+		return;
+	}
+	/* Keeps Fs, arch and the mode, clears everything that depends on the past signal */
+	for (int s = 0; s < sm->num_streams; s++) {
+		tonality_analysis_reset(&sm->streams[s].analysis);
+		memset(&sm->streams[s].analysis_info, 0, sizeof(AnalysisInfo));
+		rs_reset(sm->streams[s].resampler);
+	}
+	if (sm->rnn_state != NULL) {
+		memset(sm->rnn_state, 0, sizeof(float)*sm->num_streams*MAX_NEURONS);
+	}
+}
+
 OpusSM* sm_destroy(OpusSM* sm) {
 	if (sm == NULL) {
 		return NULL;
 	}
 
-
-	if (sm->opus_enc != NULL) {
-		opus_encoder_destroy(sm->opus_enc);
+	stop_workers(sm);
+	/* celt_mode is a static mode, it must not be freed */
+	if (sm->streams != NULL) {
+		for (int s = 0; s < sm->num_streams; s++) {
+			rs_destroy(sm->streams[s].resampler);
+			free(sm->streams[s].mono);
+			free(sm->streams[s].resampled);
+			free(sm->streams[s].mlp_features);
+		}
+		free(sm->streams);
 	}
+	free(sm->matrix);
+	free(sm->rnn_state);
+	free(sm->converted);
 	free(sm);
 	sm = NULL;
 	return sm;
 }
 
-float sm_pmusic(OpusSM* sm, float* frame) {
+int sm_frame_size(OpusSM* sm) {
 	if (sm == NULL) {
 		return 0;
 	}
-	/* Values are from opus_encode_float(), opus_encode_native() functions, see src/opus_encoder.c */
-	int c1 = 0;
-	int c2 = -2;
-	int frame_size = frame_size_select(SM_FRAME_SIZE, sm->opus_enc->variable_duration, sm->opus_enc->Fs);
-	run_analysis(&sm->opus_enc->analysis, sm->celt_mode, frame, SM_FRAME_SIZE, frame_size, c1, c2,
-	             sm->opus_enc->channels, sm->opus_enc->Fs, sm->lsb_depth, downmix_float,
-	             &sm->analysis_info);
-	return sm->analysis_info.music_prob;
+	return sm->frame_size;
+}
+
+/* Mix one input frame down to the stream's mono signal */
+static void mix_frame(OpusSM* sm, int s, const float* frame, float* mono) {
+	int C = sm->channels;
+	if (sm->matrix != NULL) {
+		const float* gains = &sm->matrix[s*C];
+		for (int j = 0; j < sm->frame_size; j++) {
+			float sum = 0;
+			for (int c = 0; c < C; c++) {
+				sum += gains[c]*frame[j*C + c];
+			}
+			mono[j] = sum;
+		}
+	} else if (sm->num_streams > 1) {
+		for (int j = 0; j < sm->frame_size; j++) {
+			mono[j] = frame[j*C + s];
+		}
+	} else {
+		/* Same average of the channels as the c2 == -2 downmix of the analysis */
+		float scale = 1.f/C;
+		for (int j = 0; j < sm->frame_size; j++) {
+			float sum = 0;
+			for (int c = 0; c < C; c++) {
+				sum += frame[j*C + c];
+			}
+			mono[j] = sum*scale;
+		}
+	}
+}
+
+/* Analyze one frame of stream s. With a batched MLP the result is left for
+   finish_frames(). 16 bit frames only come here without mixing. */
+static void analyze_frame(OpusSM* sm, int s, const void* frame, int int16) {
+	SMStream* st = &sm->streams[s];
+	AnalysisInfo* info = (sm->rnn_state != NULL) ? NULL : &st->analysis_info;
+	if (st->resampler != NULL) {
+		mix_frame(sm, s, (const float*)frame, st->mono);
+		int n = rs_process(st->resampler, st->mono, st->resampled);
+		run_analysis(&st->analysis, sm->celt_mode, st->resampled, n, n, 0, -2,
+		             1, sm->analysis_Fs, sm->lsb_depth, downmix_float,
+		             info);
+		return;
+	}
+	if (sm->matrix != NULL) {
+		mix_frame(sm, s, (const float*)frame, st->mono);
+		run_analysis(&st->analysis, sm->celt_mode, st->mono, sm->frame_size, sm->frame_size, 0, -2,
+		             1, sm->analysis_Fs, sm->lsb_depth, downmix_float,
+		             info);
+		return;
+	}
+	/* Values are from opus_encode_float(), opus_encode_native() functions, see src/opus_encoder.c.
+	   A single channel is picked with c2 == -1. downmix_int() is the opus_encode() one, with the
+	   same 1/32768 scaling as pcm_to_float(). */
+	int c1 = (sm->num_streams > 1) ? s : 0;
+	int c2 = (sm->num_streams > 1) ? -1 : -2;
+	run_analysis(&st->analysis, sm->celt_mode, frame, sm->frame_size, sm->frame_size, c1, c2,
+	             sm->channels, sm->analysis_Fs, sm->lsb_depth, int16 ? downmix_int : downmix_float,
+	             info);
+}
+
+/* Batched MLP of streams [first, last) followed by the results of the frame */
+static void finish_frames(OpusSM* sm, int first, int last) {
+	TonalityAnalysisState* batch[MAX_BATCH];
+	for (int s = first; s < last; s += MAX_BATCH) {
+		int count = (last - s < MAX_BATCH) ? last - s : MAX_BATCH;
+		for (int b = 0; b < count; b++) {
+			batch[b] = &sm->streams[s + b].analysis;
+		}
+		tonality_analysis_mlp(batch, &sm->rnn_state[(size_t)s*MAX_NEURONS], count);
+	}
+	for (int s = first; s < last; s++) {
+		SMStream* st = &sm->streams[s];
+		int len = (st->resampler != NULL) ? rs_output_size(st->resampler) : sm->frame_size;
+		st->analysis_info.valid = 0;
+		tonality_get_info(&st->analysis, &st->analysis_info, len);
+	}
+}
+
+typedef struct SMWork {
+	OpusSM*       sm;
+	const void*   pcm;
+	int           int16;
+	int           num_frames;
+	AnalysisInfo* info;
+	int           first;     /* streams [first, last) */
+	int           last;
+} SMWork;
+
+/* The streams are independent, each worker takes a contiguous range of them
+   (whose GRU states are contiguous for the batched MLP) */
+static void* analyze_streams(void* arg) {
+	SMWork* work = (SMWork*)arg;
+	OpusSM* sm = work->sm;
+	size_t stride = (size_t)sm->frame_size * sm->channels;
+	size_t sample_size = work->int16 ? sizeof(int16_t) : sizeof(float);
+	for (int ii = 0; ii < work->num_frames; ii++) {
+		for (int s = work->first; s < work->last; s++) {
+			analyze_frame(sm, s, (const char*)work->pcm + ii*stride*sample_size, work->int16);
+		}
+		if (sm->rnn_state != NULL) {
+			finish_frames(sm, work->first, work->last);
+		}
+		if (work->info != NULL) {
+			for (int s = work->first; s < work->last; s++) {
+				work->info[(size_t)ii*sm->num_streams + s] = sm->streams[s].analysis_info;
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Persistent threads of sm_set_threads(): work[0] is run by the calling
+   thread, work[1..started] by the threads, the rest (if some thread could not
+   be started) by the calling thread too. */
+typedef struct SMWorkers {
+	pthread_mutex_t lock;
+	pthread_cond_t  start;       /* a new job, or quit */
+	pthread_cond_t  done;        /* pending went down to 0 */
+	unsigned        job;         /* incremented for each call */
+	int             pending;     /* threads still working on the current job */
+	int             quit;
+	int             num_workers; /* shares of the streams */
+	int             started;
+	pthread_t       threads[SM_MAX_STREAMS];
+	SMWork          work[SM_MAX_STREAMS];
+} SMWorkers;
+
+static void* worker_main(void* arg) {
+	SMWork* work = (SMWork*)arg;
+	SMWorkers* workers = work->sm->workers;
+	unsigned job = 0;
+	pthread_mutex_lock(&workers->lock);
+	for (;;) {
+		while (!workers->quit && (workers->job == job)) {
+			pthread_cond_wait(&workers->start, &workers->lock);
+		}
+		if (workers->quit) {
+			break;
+		}
+		job = workers->job;
+		pthread_mutex_unlock(&workers->lock);
+		analyze_streams(work);
+		pthread_mutex_lock(&workers->lock);
+		if (--workers->pending == 0) {
+			pthread_cond_signal(&workers->done);
+		}
+	}
+	pthread_mutex_unlock(&workers->lock);
+	return NULL;
+}
+
+static void start_workers(OpusSM* sm) {
+	SMWorkers* workers = (SMWorkers*)calloc(1, sizeof(SMWorkers));
+	pthread_mutex_init(&workers->lock, NULL);
+	pthread_cond_init(&workers->start, NULL);
+	pthread_cond_init(&workers->done, NULL);
+	workers->num_workers = (sm->num_threads < sm->num_streams) ? sm->num_threads : sm->num_streams;
+	for (int w = 0; w < workers->num_workers; w++) {
+		workers->work[w].sm = sm;
+		workers->work[w].first = sm->num_streams * w / workers->num_workers;
+		workers->work[w].last = sm->num_streams * (w + 1) / workers->num_workers;
+	}
+	sm->workers = workers;
+	while ((workers->started + 1 < workers->num_workers) &&
+	       (pthread_create(&workers->threads[workers->started + 1], NULL, worker_main,
+	                       &workers->work[workers->started + 1]) == 0)) {
+		workers->started++;
+	}
+}
+
+static void stop_workers(OpusSM* sm) {
+	SMWorkers* workers = sm->workers;
+	if (workers == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&workers->lock);
+	workers->quit = 1;
+	pthread_cond_broadcast(&workers->start);
+	pthread_mutex_unlock(&workers->lock);
+	for (int w = 1; w <= workers->started; w++) {
+		pthread_join(workers->threads[w], NULL);
+	}
+	pthread_cond_destroy(&workers->done);
+	pthread_cond_destroy(&workers->start);
+	pthread_mutex_destroy(&workers->lock);
+	free(workers);
+	sm->workers = NULL;
+}
+
+static void analyze_frames(OpusSM* sm, const void* pcm, int int16, int num_frames, AnalysisInfo* info) {
+	SMWorkers* workers = sm->workers;
+	if (workers == NULL) {
+		SMWork work = { sm, pcm, int16, num_frames, info, 0, sm->num_streams };
+		analyze_streams(&work);
+		return;
+	}
+	for (int w = 0; w < workers->num_workers; w++) {
+		workers->work[w].pcm = pcm;
+		workers->work[w].int16 = int16;
+		workers->work[w].num_frames = num_frames;
+		workers->work[w].info = info;
+	}
+	pthread_mutex_lock(&workers->lock);
+	workers->job++;
+	workers->pending = workers->started;
+	pthread_cond_broadcast(&workers->start);
+	pthread_mutex_unlock(&workers->lock);
+	analyze_streams(&workers->work[0]);
+	for (int w = workers->started + 1; w < workers->num_workers; w++) {
+		analyze_streams(&workers->work[w]);
+	}
+	pthread_mutex_lock(&workers->lock);
+	while (workers->pending > 0) {
+		pthread_cond_wait(&workers->done, &workers->lock);
+	}
+	pthread_mutex_unlock(&workers->lock);
+}
+
+static int analyze(OpusSM* sm, const void* pcm, int int16, int num_frames, AnalysisInfo* info) {
+	if ((sm == NULL) || (sm->error != SM_OK)) {
+		return 0;
+	}
+	if (!int16 || (sm->converted == NULL)) {
+		analyze_frames(sm, pcm, int16, num_frames, info);
+		return num_frames;
+	}
+	size_t stride = (size_t)sm->frame_size*sm->channels;
+	for (int ii = 0; ii < num_frames; ii += sm->convert_frames) {
+		int count = (num_frames - ii < sm->convert_frames) ? num_frames - ii : sm->convert_frames;
+		pcm_to_float(sm->converted, (const int16_t*)pcm + ii*stride, PCM_S16, count*stride);
+		analyze_frames(sm, sm->converted, 0, count,
+		               (info != NULL) ? &info[(size_t)ii*sm->num_streams] : NULL);
+	}
+	return num_frames;
+}
+
+float sm_pmusic(OpusSM* sm, const float* frame) {
+	if (analyze(sm, frame, 0, 1, NULL) == 0) {
+		return 0;
+	}
+	return sm->streams[0].analysis_info.music_prob;
+}
+
+float sm_pmusic_int16(OpusSM* sm, const int16_t* frame) {
+	if (analyze(sm, frame, 1, 1, NULL) == 0) {
+		return 0;
+	}
+	return sm->streams[0].analysis_info.music_prob;
+}
+
+const AnalysisInfo* sm_info(OpusSM* sm) {
+	return sm_stream_info(sm, 0);
+}
+
+const AnalysisInfo* sm_stream_info(OpusSM* sm, int stream) {
+	if ((sm == NULL) || (stream < 0) || (stream >= sm->num_streams)) {
+		return NULL;
+	}
+	return &sm->streams[stream].analysis_info;
+}
+
+int sm_analyze(OpusSM* sm, const float* pcm, int num_frames, AnalysisInfo* info) {
+	return analyze(sm, pcm, 0, num_frames, info);
+}
+
+int sm_analyze_int16(OpusSM* sm, const int16_t* pcm, int num_frames, AnalysisInfo* info) {
+	return analyze(sm, pcm, 1, num_frames, info);
+}
+
+int sm_profile(OpusSM* sm, AnalysisProfile* profile) {
+	int enabled = 0;
+	if (sm == NULL) {
+		return 0;
+	}
+	for (int s = 0; s < sm->num_streams; s++) {
+		AnalysisProfile stream;
+		enabled = tonality_analysis_profile(&sm->streams[s].analysis, &stream);
+		for (int stage = 0; stage < ANALYSIS_STAGES; stage++) {
+			profile->ticks[stage] += stream.ticks[stage];
+			profile->calls[stage] += stream.calls[stage];
+		}
+	}
+	return enabled;
+}
+
+SMPool* sm_pool_init(int samplerate, int channels, int hop_ms, const float* matrix, int num_streams, int* error) {
+	OpusSM* sm = sm_init_mix(samplerate, channels, hop_ms, matrix, num_streams);
+	if (error != NULL) {
+		*error = sm_error(sm);
+	}
+	if (sm_error(sm) != SM_OK) {
+		sm_destroy(sm);
+		return NULL;
+	}
+	SMPool* pool = (SMPool*)malloc(sizeof(SMPool));
+	pool->samplerate = samplerate;
+	pool->channels = channels;
+	pool->hop_ms = hop_ms;
+	pool->matrix = NULL;
+	if (matrix != NULL) {
+		pool->matrix = (float*)malloc(sizeof(float)*num_streams*channels);
+		memcpy(pool->matrix, matrix, sizeof(float)*num_streams*channels);
+	}
+	pool->num_streams = num_streams;
+	pool->alloc_size = 16;
+	pool->free_contexts = (OpusSM**)malloc(sizeof(OpusSM*)*pool->alloc_size);
+	pool->free_contexts[0] = sm;
+	pool->num_free = 1;
+	pool->num_contexts = 1;
+	pthread_mutex_init(&pool->lock, NULL);
+	return pool;
+}
+
+OpusSM* sm_pool_acquire(SMPool* pool) {
+	if (pool == NULL) {
+		return NULL;
+	}
+	OpusSM* sm = NULL;
+	pthread_mutex_lock(&pool->lock);
+	if (pool->num_free > 0) {
+		sm = pool->free_contexts[--pool->num_free];
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	/* Outside of the lock, the context belongs to the caller now */
+	if (sm != NULL) {
+		sm_reset(sm);
+		return sm;
+	}
+	sm = sm_init_mix(pool->samplerate, pool->channels, pool->hop_ms, pool->matrix, pool->num_streams);
+	if (sm_error(sm) != SM_OK) {
+		sm_destroy(sm);
+		return NULL;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->num_contexts++;
+	pthread_mutex_unlock(&pool->lock);
+	return sm;
+}
+
+void sm_pool_release(SMPool* pool, OpusSM* sm) {
+	if ((pool == NULL) || (sm == NULL)) {
+		return;
+	}
+	/* Back to the settings of a new context, the next borrower gets the same
+	   analysis whichever context it is, and no reference to the model of
+	   this one (which may be destroyed after this) is kept */
+	sm_set_threads(sm, 1);
+	sm_set_decimation(sm, 1);
+	sm_set_analysis_outputs(sm, ANALYSIS_ALL);
+	sm_set_model(sm, NULL);
+	pthread_mutex_lock(&pool->lock);
+	if (pool->num_free == pool->alloc_size) {
+		pool->alloc_size *= 2;
+		pool->free_contexts = (OpusSM**)realloc(pool->free_contexts, sizeof(OpusSM*)*pool->alloc_size);
+	}
+	pool->free_contexts[pool->num_free++] = sm;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+SMPool* sm_pool_destroy(SMPool* pool) {
+	if (pool == NULL) {
+		return NULL;
+	}
+	if (pool->num_free != pool->num_contexts) {
+		/* Some contexts were never released, they still use the pool */
+		return pool;
+	}
+	for (int ii = 0; ii < pool->num_free; ii++) {
+		sm_destroy(pool->free_contexts[ii]);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->free_contexts);
+	free(pool->matrix);
+	free(pool);
+	pool = NULL;
+	return pool;
 }
@@ -5,33 +5,183 @@
 #include "config.h"
 #endif
 
+#include <stdint.h>
+#include <pthread.h>
 #include "src/analysis.h"
-#include "opus_sm_copy.h"
 #include "celt.h"
+#include "opus_sm_resampler.h"
+#include "opus_sm_model.h"
 
 #define SM_SUPPORTED_SAMPLERATE   48000
 //#define SM_FRAME_SIZE             (SM_SUPPORTED_SAMPLERATE/50)
 #define SM_FRAME_SIZE             2880
+/* Other input rates are resampled to the analysis rate. Any rate in
+   [SM_MIN_SAMPLERATE, SM_MAX_SAMPLERATE] with a whole number of samples in a
+   frame is accepted: at the default hop 8, 16, 22.05, 32, 44.1, 88.2, 96,
+   192 kHz... but not 11.025 kHz, whose hop has to be a multiple of 40 ms
+   (see sm_hop_step()). Rates whose ratio to the analysis rate does not
+   reduce, e.g. 191999 Hz, are rejected (see RS_MAX_FILTER_SIZE). */
+#define SM_ANALYSIS_SAMPLERATE    24000
+#define SM_MIN_SAMPLERATE         8000
+#define SM_MAX_SAMPLERATE         192000
+
+/* Hop size: one result per frame of this duration. The analysis runs on 20 ms
+   windows and keeps DETECT_SIZE of them, which limits the longest frame. */
+#define SM_DEFAULT_HOP_MS         60
+#define SM_MIN_HOP_MS             10
+#define SM_MAX_HOP_MS             ((DETECT_SIZE-5)*20)
+
+/* Fast mode: one 20 ms analysis window in up to SM_MAX_DECIMATION is analyzed */
+#define SM_MAX_DECIMATION         ANALYSIS_MAX_DECIMATION
 
 #define SM_OK                              0
 #define SM_ERR_NULL_HANDLER                1
 #define SM_ERR_UNSUPPORTED_SAMPLERATE      2
-#define SM_ERR_OPUS_ENC_CREATE_FAILED      3
+#define SM_ERR_MODE_CREATE_FAILED          3
+#define SM_ERR_UNSUPPORTED_HOP             4
+#define SM_ERR_UNSUPPORTED_MIX             5
+/* Kept for source compatibility, the SM context no longer creates an encoder */
+#define SM_ERR_OPUS_ENC_CREATE_FAILED      SM_ERR_MODE_CREATE_FAILED
 
-typedef struct OpusSM {
-	OpusEncoder* opus_enc;
-	CELTEncoder* celt_enc;
+/* Streams are the signals that are analyzed, each with its own analysis
+   state. By default there is one, the average of the input channels; there
+   can also be one per input channel, or one per row of a downmix matrix. */
+#define SM_MAX_STREAMS            64
+
+/* One analyzed signal: the tonality analysis state (including the downmix /
+   resampler memory) and its last result */
+typedef struct SMStream {
+	TonalityAnalysisState analysis;
 	AnalysisInfo analysis_info;
-	const CELTMode* celt_mode;
+	Resampler* resampler;    /* NULL when the input rate is analyzed directly */
+	float* mono;             /* mixed input frame, matrix or resampler only */
+	float* resampled;        /* resampled frame, resampler only */
+	float* mlp_features;     /* [DETECT_SIZE][MAX_NEURONS] features waiting for the batched MLP, NULL for one stream */
+} SMStream;
+
+/* Analysis-only context: it owns the streams and refers to the static,
+   read-only CELT mode whose FFT setup is shared by every stream and every
+   instance. 48 kHz and 24 kHz input goes straight to the analysis, other
+   rates are mixed down to the stream's mono signal and resampled to 24 kHz
+   first. */
+typedef struct OpusSM {
+	SMStream* streams;
+	int num_streams;
+	float* matrix;           /* [num_streams][channels] gains, NULL for the average or one stream per channel */
+	float* rnn_state;        /* [num_streams][MAX_NEURONS] GRU states of the batched MLP, NULL for one stream */
+	int num_threads;         /* streams are analyzed on up to this many threads */
+	struct SMWorkers* workers; /* threads of sm_set_threads() waiting for frames, NULL for one */
+	int decimation;          /* one analysis window in this many is analyzed, 1 for the full analysis */
+	int outputs;             /* ANALYSIS_* results computed besides the probabilities, tonality and noisiness */
+	const SMModel* model;    /* network weights, NULL for the compiled-in ones */
+	const CELTMode* celt_mode; /* tonality_analysis_mode(), shared by all contexts */
+	float* converted;        /* convert_frames frames of 16 bit input as float, NULL if the input is not mixed */
+	int convert_frames;
+	opus_int32 Fs;           /* input sample rate */
+	opus_int32 analysis_Fs;  /* rate seen by the analysis, Fs or 24 kHz */
+	int hop_ms;              /* frame duration */
+	int frame_size;          /* input samples (per channel) of one frame */
+	int channels;
 	int lsb_depth;
-	int delay_compensation;
 	int error;
 } OpusSM;
 
-
 int     sm_error(OpusSM* sm);
 OpusSM* sm_init(int samplerate, int channels);
+/* Same as sm_init() with a hop size other than SM_DEFAULT_HOP_MS, from
+   SM_MIN_HOP_MS to SM_MAX_HOP_MS, which is a whole number of samples */
+OpusSM* sm_init_hop(int samplerate, int channels, int hop_ms);
+/* Hop sizes at samplerate are the multiples of this many ms (1 at 8, 16, 48
+   kHz..., 10 at 44.1 kHz, 20 at 22.05 kHz, 40 at 11.025 kHz), 0 for an
+   unsupported rate (out of range, or too fine a ratio for the resampler) */
+int     sm_hop_step(int samplerate);
+/* Analyze num_streams signals, stream s being the input channels weighted by
+   matrix[s*channels + c]. With matrix NULL, num_streams is either 1 (the
+   average of the channels, like sm_init()) or channels (one stream per
+   channel). */
+OpusSM* sm_init_mix(int samplerate, int channels, int hop_ms, const float* matrix, int num_streams);
+/* Named downmix matrix for sm_init_mix(): "midside" (stereo: mid and side),
+   "stereo" (5.1 to stereo with the ITU-R BS.775 gains, without LFE). Store
+   the gains in matrix (num_streams*channels, if not NULL) and return
+   num_streams, 0 if the name is unknown or does not apply to channels. */
+int     sm_mix_matrix(const char* name, int channels, float* matrix);
+/* Analyze the streams on up to num_threads threads (default: 1). The extra
+   threads are started here and wait for the frames of every sm_analyze*()
+   call, until the next sm_set_threads() or sm_destroy(). */
+void    sm_set_threads(OpusSM* sm, int num_threads);
+/* Fast mode: compute the spectrum of only one 20 ms window in decimation, 1
+   to SM_MAX_DECIMATION (default: 1, all of them), the others are
+   interpolated. The music probability is less accurate and the last
+   decimation-1 windows of a frame only get their result in the next one;
+   bandwidth and leak_boost are not computed. Call it before the first frame
+   or after sm_reset(). */
+void    sm_set_decimation(OpusSM* sm, int decimation);
+/* Compute only these encoder oriented results (ANALYSIS_BANDWIDTH,
+   ANALYSIS_LEAKAGE, ANALYSIS_MAX_PITCH, see src/analysis.h, default:
+   ANALYSIS_ALL), the others are left at 0 (max_pitch_ratio at 1) and cost
+   nothing. Call it before the first frame or after sm_reset(). */
+void    sm_set_analysis_outputs(OpusSM* sm, int outputs);
+/* Use the network weights of model (see sm/opus_sm_model.h), NULL for the
+   compiled-in ones (default). The model is only read, one can be shared by
+   any number of contexts and threads, and it must outlive them. It can be
+   changed between frames: the GRU states are kept, call sm_reset() too for
+   a clean start. */
+void    sm_set_model(OpusSM* sm, const SMModel* model);
+int     sm_streams(OpusSM* sm);
+/* Forget the past signal, for the analysis of an unrelated one: clears the
+   analysis states (tonality_analysis_reset()) and the resampler memory,
+   keeps the configuration and settings. Nothing is allocated. */
+void    sm_reset(OpusSM* sm);
 OpusSM* sm_destroy(OpusSM* sm);
-float   sm_pmusic(OpusSM* sm, float* frame);
+/* Number of samples per channel that sm_pmusic() reads: one hop at the input rate */
+int     sm_frame_size(OpusSM* sm);
+/* Analyze a frame and return the music probability of the first stream */
+float   sm_pmusic(OpusSM* sm, const float* frame);
+/* Same as sm_pmusic(), the interleaved 16 bit samples are converted while they are read */
+float   sm_pmusic_int16(OpusSM* sm, const int16_t* frame);
+/* Full analysis result of the last frame (music probability, VAD probability, tonality, ...) of the first stream */
+const AnalysisInfo* sm_info(OpusSM* sm);
+const AnalysisInfo* sm_stream_info(OpusSM* sm, int stream);
+/* Analyze num_frames consecutive frames of interleaved samples (sm_frame_size()
+   samples per channel each) and store the full result of every frame and
+   stream in info[frame*sm_streams() + stream] (info may be NULL). Return the
+   number of analyzed frames, 0 on error. */
+int     sm_analyze(OpusSM* sm, const float* pcm, int num_frames, AnalysisInfo* info);
+int     sm_analyze_int16(OpusSM* sm, const int16_t* pcm, int num_frames, AnalysisInfo* info);
+/* Add the time spent in each analysis stage by all the streams to profile
+   (see AnalysisProfile in src/analysis.h). Return 0 if the analysis was built
+   without ANALYSIS_PROFILE (--enable-analysis-profile). */
+int     sm_profile(OpusSM* sm, AnalysisProfile* profile);
+
+/* Pool of contexts of the same configuration, for many short independent
+   analyses (clips) on any number of threads: a released context is reset
+   and given to the next sm_pool_acquire() instead of being destroyed and
+   initialized again. */
+typedef struct SMPool {
+	int      samplerate;
+	int      channels;
+	int      hop_ms;
+	float*   matrix;             /* sm_init_mix() arguments */
+	int      num_streams;
+	OpusSM** free_contexts;      /* released contexts, reset on acquire */
+	int      num_free;
+	int      alloc_size;
+	int      num_contexts;       /* created and not destroyed */
+	pthread_mutex_t lock;
+} SMPool;
+
+/* Same arguments as sm_init_mix(), one context is created to check them.
+   Return NULL on error, with the SM_ERR_* code in error (if not NULL). */
+SMPool* sm_pool_init(int samplerate, int channels, int hop_ms, const float* matrix, int num_streams, int* error);
+/* Get a context in its initial state with the default settings (as a new
+   one: 1 thread, no decimation, ANALYSIS_ALL, the compiled-in model), a new
+   one if none is free. NULL if a new one cannot be created. Thread-safe. */
+OpusSM* sm_pool_acquire(SMPool* pool);
+/* Give a context back to the pool, it must not be used anymore. Its settings
+   are restored to the defaults. Thread-safe. */
+void    sm_pool_release(SMPool* pool, OpusSM* sm);
+/* Destroy the pool and its contexts and return NULL. If some contexts were
+   not released, nothing is destroyed and the pool is returned. */
+SMPool* sm_pool_destroy(SMPool* pool);
 
-#endif /* _OPUS_SM_H_ */
\ No newline at end of file
+#endif /* _OPUS_SM_H_ */
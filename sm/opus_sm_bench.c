@@ -0,0 +1,576 @@
+/*
+ * Benchmark and regression check of the SM analysis
+ *
+ * Analyzes synthetic speech-like and music-like signals (or the WAVE files of
+ * a directory) frame by frame with sm_pmusic(), reports the realtime factor,
+ * the per-frame latency percentiles and the peak RSS, and compares the music
+ * probabilities and labels with golden files.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include "opus_sm.h"
+#include "opus_sm_label.h"
+#include "wavfile.h"
+
+#ifndef M_PI
+#define M_PI 3.141592653
+#endif
+
+#define SYNTH_RATE            48000
+#define SYNTH_SEGMENT_DUR     10     /* seconds of speech or music in the mixed signal */
+#define DEFAULT_SYNTH_DUR     30
+#define DEFAULT_TOLERANCE     1e-3
+#define SM_SEGMENT_MIN_DUR    4.0
+#define B_SEGMENT_MIN_DUR     4.0
+
+void print_syntax(const char* argv0) {
+		printf("SM analysis benchmark and regression check\n");
+		printf("\n");
+		printf("Usage: %s [options]\n", argv0);
+		printf("\n");
+		printf("Without -c, analyzes synthetic signals: speech, music and mixed (alternating %d s of each).\n", SYNTH_SEGMENT_DUR);
+		printf("\n");
+		printf("Options:\n");
+		printf("    -c <dir>         analyze the WAVE files of this directory instead\n");
+		printf("    -l <seconds>     duration of each synthetic signal, twice that for mixed (default: %d)\n", DEFAULT_SYNTH_DUR);
+		printf("    -g <dir>         compare the music probabilities and labels with <dir>/<name>.pmusic and <name>.labels\n");
+		printf("    -u               write the golden files of -g instead of comparing\n");
+		printf("    -e <tolerance>   largest accepted music probability difference (default: %g)\n", DEFAULT_TOLERANCE);
+		printf("    -t <ms>          hop size (default: %d)\n", SM_DEFAULT_HOP_MS);
+		printf("    -d <n>           fast mode, see opus_sm_demo (default: 1)\n");
+		printf("    -n <model>       network weights file instead of the compiled-in ones\n");
+		printf("\n");
+		printf("The exit status is non-zero if a file cannot be analyzed or differs from its golden files.\n");
+}
+
+
+/* Synthetic signals ======================================================== */
+
+/* Deterministic on every platform, unlike rand() */
+typedef struct Random {
+	uint32_t state;
+} Random;
+
+static uint32_t rnd_next(Random* rnd) {
+	rnd->state = rnd->state*1664525u + 1013904223u;
+	return rnd->state;
+}
+
+/* Uniform in [lo, hi) */
+static double rnd_uniform(Random* rnd, double lo, double hi) {
+	return lo + (hi - lo)*(rnd_next(rnd) >> 8)*(1.0/16777216.0);
+}
+
+/* Sum of 4 uniforms, close enough to a unit gaussian for a noise floor */
+static double rnd_noise(Random* rnd) {
+	double sum = 0;
+	for (int k = 0; k < 4; k++) {
+		sum += rnd_uniform(rnd, -1, 1);
+	}
+	return sum*0.866;
+}
+
+/* Voiced speech: a pulse train with a slowly moving pitch through 3 formant
+   resonators which change every 120 ms, with a 4 Hz syllable envelope and
+   pauses. */
+static void synth_speech(Random* rnd, float* out, int n) {
+	const int fs = SYNTH_RATE;
+	const int segment = (int)(0.12*fs);
+	const double formants[3][3] = {{300, 900, 80}, {900, 2500, 120}, {2400, 3500, 200}};
+	double a1[3] = {0}, a2[3] = {0};
+	double state[3][2] = {{0}};
+	double phase = 0;
+	double pause_phase = rnd_uniform(rnd, 0, 6);
+	double env_phase = rnd_uniform(rnd, 0, 6);
+	for (int i = 0; i < n; i++) {
+		if (i % segment == 0) {
+			for (int k = 0; k < 3; k++) {
+				double r = exp(-M_PI*formants[k][2]/fs);
+				double theta = 2*M_PI*rnd_uniform(rnd, formants[k][0], formants[k][1])/fs;
+				a1[k] = -2*r*cos(theta);
+				a2[k] = r*r;
+			}
+		}
+		double t = (double)i/fs;
+		phase += (120 + 30*sin(2*M_PI*0.7*t))/fs;
+		double v = 0.02*rnd_noise(rnd);
+		if (phase >= 1) {
+			phase -= 1;
+			v += 1;
+		}
+		double y = 0;
+		for (int k = 0; k < 3; k++) {
+			double o = v - a1[k]*state[k][0] - a2[k]*state[k][1];
+			state[k][1] = state[k][0];
+			state[k][0] = o;
+			y += o;
+		}
+		double env = sin(2*M_PI*4*t + env_phase) + 0.3;
+		if ((env < 0) || (sin(2*M_PI*0.3*t + pause_phase) < -0.6)) {
+			env = 0;
+		}
+		out[i] = (float)(y*env);
+	}
+}
+
+/* Three note chords of 5 harmonics, a new one every 250 ms, decaying */
+static void synth_music(Random* rnd, float* out, int n) {
+	const int fs = SYNTH_RATE;
+	const int note = fs/4;
+	for (int s = 0; s < n; s += note) {
+		double f[3];
+		for (int k = 0; k < 3; k++) {
+			f[k] = 220*pow(2, (rnd_next(rnd) >> 8) % 24/12.0);
+		}
+		for (int i = s; (i < n) && (i < s + note); i++) {
+			double t = (double)(i - s)/fs;
+			double v = 0;
+			for (int k = 0; k < 3; k++) {
+				for (int h = 1; h <= 5; h++) {
+					v += sin(2*M_PI*f[k]*h*t)/h;
+				}
+			}
+			out[i] = (float)(v*exp(-3*t));
+		}
+	}
+}
+
+/* Scale to a peak of 0.3 */
+static void normalize(float* x, int n) {
+	float peak = 0;
+	for (int i = 0; i < n; i++) {
+		peak = (fabsf(x[i]) > peak) ? fabsf(x[i]) : peak;
+	}
+	if (peak > 0) {
+		for (int i = 0; i < n; i++) {
+			x[i] *= 0.3f/peak;
+		}
+	}
+}
+
+/* Signal name: "speech", "music" or "mixed" (starting with speech). Return a
+   malloc'd mono 48 kHz signal of *n samples. */
+static float* synthesize(const char* name, int duration, int* n) {
+	Random rnd = {12345};
+	int mixed = (strcmp(name, "mixed") == 0);
+	int segment = mixed ? SYNTH_SEGMENT_DUR*SYNTH_RATE : duration*SYNTH_RATE;
+	*n = (mixed ? 2 : 1)*duration*SYNTH_RATE;
+	float* x = (float*)malloc(sizeof(float)*(*n));
+	for (int s = 0, k = 0; s < *n; s += segment, k++) {
+		int len = (*n - s < segment) ? *n - s : segment;
+		if ((strcmp(name, "music") == 0) || (mixed && (k % 2 == 1))) {
+			synth_music(&rnd, &x[s], len);
+		} else {
+			synth_speech(&rnd, &x[s], len);
+		}
+		normalize(&x[s], len);
+	}
+	return x;
+}
+
+
+/* Analysis ================================================================= */
+
+typedef struct Options {
+	const char* golden_dir;
+	int         update;
+	double      tolerance;
+	int         hop_ms;
+	int         decimation;
+	const SMModel* model;
+} Options;
+
+typedef struct Result {
+	double  audio_dur;     /* seconds */
+	double  elapsed;       /* seconds in sm_pmusic() */
+	double* latency;       /* of every frame, seconds */
+	int     count;         /* frames */
+	float*  pmusic;
+	char*   labels;        /* lb_print_to_file() output */
+} Result;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+}
+
+static void add_frame(Result* r, float pmusic, double latency) {
+	r->pmusic[r->count] = pmusic;
+	r->latency[r->count] = latency;
+	r->elapsed += latency;
+	r->count++;
+}
+
+static OpusSM* open_sm(int samplerate, int channels, const Options* opt) {
+	OpusSM* sm = sm_init_hop(samplerate, channels, opt->hop_ms);
+	if (sm_error(sm) != SM_OK) {
+		fprintf(stderr, "Could not initialize the SM analysis context at %d Hz, %d channels. Error code: %d\n",
+		        samplerate, channels, sm_error(sm));
+		return sm_destroy(sm);
+	}
+	sm_set_decimation(sm, opt->decimation);
+	/* Only the music probability is needed */
+	sm_set_analysis_outputs(sm, 0);
+	sm_set_model(sm, opt->model);
+	return sm;
+}
+
+static int analyze_signal(const float* x, int n, const Options* opt, Result* r) {
+	OpusSM* sm = open_sm(SYNTH_RATE, 1, opt);
+	if (sm == NULL) {
+		return 1;
+	}
+	int frame_size = sm_frame_size(sm);
+	int frames = n/frame_size;
+	r->pmusic = (float*)malloc(sizeof(float)*(frames + 1));
+	r->latency = (double*)malloc(sizeof(double)*(frames + 1));
+	for (int f = 0; f < frames; f++) {
+		double start = now();
+		float pmusic = sm_pmusic(sm, &x[(size_t)f*frame_size]);
+		add_frame(r, pmusic, now() - start);
+	}
+	r->audio_dur = (double)frames*frame_size/SYNTH_RATE;
+	sm_destroy(sm);
+	return 0;
+}
+
+/* 16 bit files are analyzed from the int16 samples like opus_sm_demo does */
+static int analyze_file(const char* path, const Options* opt, Result* r) {
+	WAVE* wave = wopen(path, "r");
+	if ((wave == NULL) || (wgetheader(wave) != WAVE_OK) || (wave->size == WAVE_SIZE_UNKNOWN)) {
+		fprintf(stderr, "Error while reading wave file \"%s\".\n", path);
+		wclose(wave);
+		return 1;
+	}
+	wmap(wave);
+	OpusSM* sm = open_sm(wave->header.SampleRate, wave->header.NumChannels, opt);
+	if (sm == NULL) {
+		wclose(wave);
+		return 1;
+	}
+	int frame_size = sm_frame_size(sm);
+	int64_t frames = wave->size/frame_size;
+	r->pmusic = (float*)malloc(sizeof(float)*(frames + 1));
+	r->latency = (double*)malloc(sizeof(double)*(frames + 1));
+	float* buffer = (float*)malloc(sizeof(float)*frame_size*wave->header.NumChannels);
+	for (int64_t f = 0; f < frames; f++) {
+		double start;
+		float pmusic;
+		if (wis_pcm16(wave)) {
+			const int16_t* pcm;
+			if (wview(wave, frame_size, (int16_t*)buffer, &pcm) != frame_size) {
+				break;
+			}
+			start = now();
+			pmusic = sm_pmusic_int16(sm, pcm);
+		} else {
+			if (wread_float(buffer, frame_size, wave) != frame_size) {
+				break;
+			}
+			start = now();
+			pmusic = sm_pmusic(sm, buffer);
+		}
+		add_frame(r, pmusic, now() - start);
+	}
+	r->audio_dur = (double)r->count*frame_size/wave->header.SampleRate;
+	free(buffer);
+	sm_destroy(sm);
+	wclose(wave);
+	return 0;
+}
+
+/* Label the frames like opus_sm_demo, into a malloc'd string */
+static void label(Result* r, double frame_dur) {
+	Labeler* lb = lb_init(SM_SEGMENT_MIN_DUR/frame_dur, B_SEGMENT_MIN_DUR/frame_dur);
+	for (int f = 0; f < r->count; f++) {
+		lb_add_frame(lb, r->pmusic[f]);
+	}
+	lb_finalize(lb);
+	FILE* fp = tmpfile();
+	lb_print_to_file(lb, fp, frame_dur);
+	long size = ftell(fp);
+	r->labels = (char*)calloc(size + 1, 1);
+	rewind(fp);
+	if (fread(r->labels, 1, size, fp) != (size_t)size) {
+		r->labels[0] = '\0';
+	}
+	fclose(fp);
+	lb_destroy(lb);
+}
+
+
+/* Golden files ============================================================= */
+
+static char* golden_path(const char* dir, const char* name, const char* suffix) {
+	size_t len = strlen(dir) + strlen(name) + strlen(suffix) + 2;
+	char* path = (char*)malloc(len);
+	snprintf(path, len, "%s/%s%s", dir, name, suffix);
+	return path;
+}
+
+/* Same text format as opus_sm_demo */
+static int write_golden(const char* dir, const char* name, const Result* r, double frame_dur) {
+	char* pmusic_path = golden_path(dir, name, ".pmusic");
+	char* labels_path = golden_path(dir, name, ".labels");
+	FILE* fp = fopen(pmusic_path, "w");
+	int error = (fp == NULL);
+	for (int f = 0; !error && (f < r->count); f++) {
+		fprintf(fp, "%f %f\n", f*frame_dur, r->pmusic[f]);
+	}
+	error = error || (fclose(fp) != 0);
+	fp = error ? NULL : fopen(labels_path, "w");
+	error = error || (fp == NULL) || (fputs(r->labels, fp) < 0);
+	error = (fp != NULL) ? ((fclose(fp) != 0) || error) : error;
+	if (error) {
+		fprintf(stderr, "Error while writing the golden files %s and %s.\n", pmusic_path, labels_path);
+	}
+	free(pmusic_path);
+	free(labels_path);
+	return error;
+}
+
+/* Return the number of differences, print the largest */
+static int compare_golden(const char* dir, const char* name, const Result* r, double tolerance) {
+	char* pmusic_path = golden_path(dir, name, ".pmusic");
+	char* labels_path = golden_path(dir, name, ".labels");
+	int errors = 0;
+
+	FILE* fp = fopen(pmusic_path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "%s: missing golden file %s\n", name, pmusic_path);
+		errors++;
+	} else {
+		int count = 0;
+		int worst = -1;
+		double max_diff = 0;
+		double t, pmusic;
+		while (fscanf(fp, "%lf %lf", &t, &pmusic) == 2) {
+			if (count < r->count) {
+				double diff = fabs(pmusic - r->pmusic[count]);
+				if (diff > max_diff) {
+					max_diff = diff;
+					worst = count;
+				}
+				errors += (diff > tolerance);
+			}
+			count++;
+		}
+		fclose(fp);
+		if (count != r->count) {
+			fprintf(stderr, "%s: %d frames, %d in %s\n", name, r->count, count, pmusic_path);
+			errors++;
+		}
+		printf("    pmusic max diff: %g", max_diff);
+		if (worst >= 0) {
+			printf(" (frame %d)", worst);
+		}
+		printf(", %d frames over %g\n", errors, tolerance);
+	}
+
+	fp = fopen(labels_path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "%s: missing golden file %s\n", name, labels_path);
+		errors++;
+	} else {
+		size_t len = strlen(r->labels);
+		char* golden = (char*)malloc(len + 2);
+		size_t read = fread(golden, 1, len + 1, fp);
+		int same = (read == len) && (memcmp(golden, r->labels, len) == 0);
+		printf("    labels: %s\n", same ? "same" : "DIFFERENT");
+		errors += !same;
+		free(golden);
+		fclose(fp);
+	}
+	free(pmusic_path);
+	free(labels_path);
+	return errors;
+}
+
+
+/* Report =================================================================== */
+
+static int compare_double(const void* a, const void* b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/* Nearest rank percentile of sorted values */
+static double percentile(const double* sorted, int count, double p) {
+	int rank = (int)ceil(p/100*count);
+	return sorted[(rank < 1) ? 0 : rank - 1];
+}
+
+static void print_result(const char* name, Result* r) {
+	if (r->count == 0) {
+		printf("%-20s no frames\n", name);
+		return;
+	}
+	qsort(r->latency, r->count, sizeof(double), compare_double);
+	int music = 0;
+	for (int f = 0; f < r->count; f++) {
+		music += (r->pmusic[f] > 0.5f);
+	}
+	printf("%-20s %8.1f s %6d frames  music %5.3f  realtime x%7.1f  latency us p50 %6.1f p90 %6.1f p99 %6.1f max %6.1f\n",
+	       name, r->audio_dur, r->count, (double)music/r->count, r->audio_dur/r->elapsed,
+	       1e6*percentile(r->latency, r->count, 50), 1e6*percentile(r->latency, r->count, 90),
+	       1e6*percentile(r->latency, r->count, 99), 1e6*r->latency[r->count - 1]);
+}
+
+/* Analyze, report and check one signal or file. Return non-zero on failure. */
+static int run(const char* name, const char* path, int duration, const Options* opt) {
+	Result r;
+	memset(&r, 0, sizeof(Result));
+	int error;
+	if (path == NULL) {
+		int n;
+		float* x = synthesize(name, duration, &n);
+		error = analyze_signal(x, n, opt, &r);
+		free(x);
+	} else {
+		error = analyze_file(path, opt, &r);
+	}
+	if (!error) {
+		double frame_dur = opt->hop_ms/1000.0;
+		label(&r, frame_dur);
+		print_result(name, &r);
+		if (opt->golden_dir != NULL) {
+			error = opt->update ? write_golden(opt->golden_dir, name, &r, frame_dur)
+			                    : (compare_golden(opt->golden_dir, name, &r, opt->tolerance) != 0);
+		}
+	}
+	free(r.pmusic);
+	free(r.latency);
+	free(r.labels);
+	return error;
+}
+
+static int compare_string(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* Run the .wav files of dir in name order, return the number of failures */
+static int run_corpus(const char* dir, const Options* opt) {
+	DIR* d = opendir(dir);
+	if (d == NULL) {
+		fprintf(stderr, "Error while opening directory \"%s\".\n", dir);
+		return 1;
+	}
+	int count = 0;
+	int alloc_size = 0;
+	char** names = NULL;
+	struct dirent* entry;
+	while ((entry = readdir(d)) != NULL) {
+		size_t len = strlen(entry->d_name);
+		if ((len > 4) && (strcasecmp(&entry->d_name[len - 4], ".wav") == 0)) {
+			if (count == alloc_size) {
+				alloc_size = (alloc_size == 0) ? 64 : 2*alloc_size;
+				names = (char**)realloc(names, alloc_size*sizeof(char*));
+			}
+			names[count++] = strdup(entry->d_name);
+		}
+	}
+	closedir(d);
+	qsort(names, count, sizeof(char*), compare_string);
+
+	int failed = 0;
+	for (int ii = 0; ii < count; ii++) {
+		char* path = golden_path(dir, names[ii], "");
+		/* The golden files are named after the file, without .wav */
+		names[ii][strlen(names[ii]) - 4] = '\0';
+		failed += (run(names[ii], path, 0, opt) != 0);
+		free(path);
+		free(names[ii]);
+	}
+	free(names);
+	if (count == 0) {
+		fprintf(stderr, "No WAVE files in \"%s\".\n", dir);
+		failed++;
+	}
+	return failed;
+}
+
+
+int main(int argc, char* argv[]) {
+	Options opt;
+	opt.golden_dir = NULL;
+	opt.update = 0;
+	opt.tolerance = DEFAULT_TOLERANCE;
+	opt.hop_ms = SM_DEFAULT_HOP_MS;
+	opt.decimation = 1;
+	opt.model = NULL;
+	const char* corpus = NULL;
+	const char* model_file = NULL;
+	int duration = DEFAULT_SYNTH_DUR;
+	for (int argi = 1; argi < argc; argi++) {
+		if ((strcmp(argv[argi], "-c") == 0) && (argi + 1 < argc)) {
+			corpus = argv[++argi];
+		} else if ((strcmp(argv[argi], "-l") == 0) && (argi + 1 < argc)) {
+			duration = atoi(argv[++argi]);
+		} else if ((strcmp(argv[argi], "-g") == 0) && (argi + 1 < argc)) {
+			opt.golden_dir = argv[++argi];
+		} else if (strcmp(argv[argi], "-u") == 0) {
+			opt.update = 1;
+		} else if ((strcmp(argv[argi], "-e") == 0) && (argi + 1 < argc)) {
+			opt.tolerance = atof(argv[++argi]);
+		} else if ((strcmp(argv[argi], "-t") == 0) && (argi + 1 < argc)) {
+			opt.hop_ms = atoi(argv[++argi]);
+		} else if ((strcmp(argv[argi], "-d") == 0) && (argi + 1 < argc)) {
+			opt.decimation = atoi(argv[++argi]);
+		} else if ((strcmp(argv[argi], "-n") == 0) && (argi + 1 < argc)) {
+			model_file = argv[++argi];
+		} else {
+			print_syntax(argv[0]);
+			return 1;
+		}
+	}
+	if ((duration < 1) || (opt.update && (opt.golden_dir == NULL))) {
+		print_syntax(argv[0]);
+		return 1;
+	}
+
+	SMModel* model = NULL;
+	if (model_file != NULL) {
+		int model_error;
+		model = sm_model_load(model_file, &model_error);
+		if (model == NULL) {
+			fprintf(stderr, "Error while loading model file \"%s\", error code: %d.\n", model_file, model_error);
+			return 1;
+		}
+		opt.model = model;
+	}
+
+	int failed = 0;
+	if (corpus != NULL) {
+		failed = run_corpus(corpus, &opt);
+	} else {
+		const char* names[3] = {"speech", "music", "mixed"};
+		for (int ii = 0; ii < 3; ii++) {
+			failed += (run(names[ii], NULL, duration, &opt) != 0);
+		}
+	}
+
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		/* kilobytes on Linux */
+		printf("peak RSS: %ld kB\n", usage.ru_maxrss);
+	}
+	if (failed > 0) {
+		printf("%d FAILED\n", failed);
+	}
+	sm_model_destroy(model);
+	return (failed != 0);
+}
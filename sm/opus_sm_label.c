@@ -5,22 +5,53 @@
 
 #define ALLOC_SIZE (16)
 
+static void lb_setup(Labeler* lb, unsigned int sm_thresh, unsigned int b_thresh) {
+	lb->count = 0;
+	lb->sm_thresh = sm_thresh;
+	lb->b_thresh = b_thresh;
+	lb->next = 0;
+	lb->pending.type = 0;
+	lb->pending.frame_count = 0;
+	lb->absorb = 0;
+	lb->carry = 0;
+	lb->start = 0;
+	lb->tag = -1;
+}
+
 Labeler* lb_init(unsigned int sm_thresh, unsigned int b_thresh) {
 	Labeler* lb = (Labeler*)malloc(sizeof(Labeler));
+	lb_setup(lb, sm_thresh, b_thresh);
 	lb->labels = (Label*)malloc(sizeof(Label)*ALLOC_SIZE);
-	lb->count = 0;
 	lb->alloc_size = ALLOC_SIZE;
-	lb->sm_thresh = sm_thresh;
-	lb->b_thresh = b_thresh;
+	lb->own_labels = 1;
+	lb->own_self = 1;
+	return lb;
+}
+
+Labeler* lb_init_arena(Labeler* lb, unsigned int sm_thresh, unsigned int b_thresh, Label* arena, unsigned int arena_size) {
+	lb_setup(lb, sm_thresh, b_thresh);
+	lb->labels = arena;
+	lb->alloc_size = arena_size;
+	lb->own_labels = 0;
+	lb->own_self = 0;
 	return lb;
 }
 
-/* Add label to array */
+/* Add label to array. The capacity doubles, so appends are amortized O(1). */
 void lb_add_to_arr(Labeler* lb, Label label) {
 	assert(ALLOC_SIZE > 0);
 	if (lb->count == lb->alloc_size) {
-		lb->alloc_size += ALLOC_SIZE;
-		lb->labels = (Label*)realloc(lb->labels, sizeof(Label)*lb->alloc_size);
+		unsigned int alloc_size = (lb->alloc_size < ALLOC_SIZE) ? ALLOC_SIZE : 2*lb->alloc_size;
+		if (lb->own_labels) {
+			lb->labels = (Label*)realloc(lb->labels, sizeof(Label)*alloc_size);
+		} else {
+			/* The arena is full, continue on the heap */
+			Label* labels = (Label*)malloc(sizeof(Label)*alloc_size);
+			memcpy(labels, lb->labels, sizeof(Label)*lb->count);
+			lb->labels = labels;
+			lb->own_labels = 1;
+		}
+		lb->alloc_size = alloc_size;
 	}
 	lb->labels[lb->count] = label;
 	lb->count++;
@@ -62,42 +93,40 @@ void lb_add_frame(Labeler* lb, float pmusic) {
 	return;
 }
 
-void lb_remove(Labeler* lb, unsigned int index) {
-	assert(lb->count > index);
-	
-	memmove(&lb->labels[index], &lb->labels[index+1], (lb->count-index-1)*sizeof(Label));
-	lb->count--;
-}
-
-unsigned int lb_remove_merge_b(Labeler* lb, unsigned int index) {
-	if (lb->count == 1) {
-	    return index + 1;
-	}
-
-	if (index == 0) {
-		lb->labels[index+1].frame_count += lb->labels[index].frame_count;
-		lb_remove(lb, index);
-		return index;
-	}
-	
-	lb->labels[index-1].frame_count += lb->labels[index].frame_count;
-	lb_remove(lb, index);
-	if ((lb->count > index) &&
-	   (lb->labels[index-1].type == lb->labels[index].type)) {
-		lb->labels[index-1].frame_count += lb->labels[index].frame_count;
-		lb_remove(lb, index);
-	}
-	return index;
-}
-
+/* Merge every 'b' label shorter than b_thresh into the label before it (into
+   the one after it at the start), then merge the two labels around it if they
+   have the same type. A single label is kept even if it is a short 'b'. The
+   array is compacted in one pass: labels are read at r and written at w <= r. */
 void lb_remove_short_b(Labeler* lb) {
-	for (unsigned int ii = 0; ii < lb->count; ii++) {
-		if ((lb->labels[ii].type == 'b') &&
-		   (lb->labels[ii].frame_count < lb->b_thresh)) {
-			// intended possible overflow, ii++ will recover it
-			ii = lb_remove_merge_b(lb, ii) - 1;
+	unsigned int w = 0;
+	unsigned int carry = 0;  /* frames of a leading short 'b' */
+	int absorb = 0;          /* a short 'b' was merged into labels[w-1] */
+	for (unsigned int r = 0; r < lb->count; r++) {
+		Label label = lb->labels[r];
+		if ((label.type == 'b') && (label.frame_count < lb->b_thresh)) {
+			if (w > 0) {
+				lb->labels[w-1].frame_count += label.frame_count;
+				absorb = 1;
+			} else {
+				carry += label.frame_count;
+			}
+			continue;
 		}
+		if (absorb && (label.type == lb->labels[w-1].type)) {
+			lb->labels[w-1].frame_count += label.frame_count;
+			absorb = 0;
+			continue;
+		}
+		absorb = 0;
+		label.frame_count += carry;
+		carry = 0;
+		lb->labels[w++] = label;
+	}
+	if ((w == 0) && (lb->count > 0)) {
+		lb->labels[0].frame_count = carry;
+		w = 1;
 	}
+	lb->count = w;
 }
 
 void lb_finalize(Labeler* lb) {
@@ -111,6 +140,9 @@ void lb_print_to_file(Labeler* lb, FILE* ofile, double frame_duration) {
 
 	double start = 0;
 	for (unsigned int ii = 0; ii < lb->count; ii++) {
+		if (lb->tag >= 0) {
+			fprintf(ofile, "%d ", lb->tag);
+		}
 		fprintf(ofile, "%f %f %c\n",
 		        (double)start,
 		        (double)start + frame_duration * lb->labels[ii].frame_count,
@@ -119,14 +151,118 @@ void lb_print_to_file(Labeler* lb, FILE* ofile, double frame_duration) {
 	}
 }
 
+/* Print one segment of the incremental output, same format as lb_print_to_file() */
+void lb_print_segment(Labeler* lb, FILE* ofile, double frame_duration, Label label) {
+	if (ofile != NULL) {
+		if (lb->tag >= 0) {
+			fprintf(ofile, "%d ", lb->tag);
+		}
+		fprintf(ofile, "%f %f %c\n",
+		        (double)lb->start,
+		        (double)lb->start + frame_duration * label.frame_count,
+		        label.type);
+	}
+	lb->start = lb->start + frame_duration * label.frame_count;
+}
+
+/* Does the same merges as lb_remove_short_b(), but label by label, as soon as
+   the labels involved are settled. lb_add_frame() only changes the last label
+   (which becomes 'b' or is replaced if it ends before sm_thresh frames) and
+   the length of a 'b' right before it, so a label is settled when it is
+   followed by two others, or by one that has reached sm_thresh frames. A
+   segment is printed when the label after it turns out not to be merged into
+   it, so a segment is printed at most sm_thresh + b_thresh frames after
+   its end. Return the number of printed segments. */
+int lb_flush_to_file(Labeler* lb, FILE* ofile, double frame_duration, int last) {
+	int printed = 0;
+	while (lb->next < lb->count) {
+		Label label = lb->labels[lb->next];
+		unsigned int after = lb->count - lb->next - 1;
+		int current_short = (lb->labels[lb->count - 1].frame_count < lb->sm_thresh);
+		int fixed_length = last || (after >= 2) || ((after == 1) && ((label.type != 'b') || !current_short));
+		int fixed_type = last || (after >= 1) || !current_short;
+		int short_b = (label.type == 'b') && (label.frame_count < lb->b_thresh);
+
+		if (short_b) {
+			/* May still grow over b_thresh */
+			if (!fixed_length) {
+				break;
+			}
+			if (lb->pending.type != 0) {
+				lb->pending.frame_count += label.frame_count;
+				lb->absorb = 1;
+			} else {
+				lb->carry += label.frame_count;
+			}
+			lb->next++;
+			continue;
+		}
+
+		if (!fixed_type) {
+			break;
+		}
+
+		if ((lb->pending.type != 0) && lb->absorb && (label.type == lb->pending.type)) {
+			if (!fixed_length) {
+				break;
+			}
+			lb->pending.frame_count += label.frame_count;
+			lb->absorb = 0;
+			lb->next++;
+			continue;
+		}
+
+		/* Nothing can be merged into the pending segment any more */
+		if (lb->pending.type != 0) {
+			lb_print_segment(lb, ofile, frame_duration, lb->pending);
+			lb->pending.type = 0;
+			lb->absorb = 0;
+			printed++;
+		}
+
+		if (!fixed_length) {
+			break;
+		}
+		lb->pending = label;
+		lb->pending.frame_count += lb->carry;
+		lb->carry = 0;
+		lb->next++;
+	}
+
+	if (last) {
+		if (lb->pending.type != 0) {
+			lb_print_segment(lb, ofile, frame_duration, lb->pending);
+			printed++;
+		} else if (lb->carry > 0) {
+			/* Only short 'b' frames were seen: keep them as a single 'b' segment at the end of the stream */
+			Label label;
+			label.type = 'b';
+			label.frame_count = lb->carry;
+			lb_print_segment(lb, ofile, frame_duration, label);
+			printed++;
+		}
+		lb->pending.type = 0;
+		lb->absorb = 0;
+		lb->carry = 0;
+	}
+
+	/* Drop the labels that were passed to the output, only the unsettled tail stays */
+	memmove(&lb->labels[0], &lb->labels[lb->next], (lb->count - lb->next)*sizeof(Label));
+	lb->count -= lb->next;
+	lb->next = 0;
+	return printed;
+}
+
 Labeler* lb_destroy(Labeler* lb) {
 	if (lb == NULL) {
 		return lb;
 	}
-	if (lb->labels != NULL) {
+	if (lb->own_labels) {
 		free(lb->labels);
 	}
-
-	free(lb);
+	if (lb->own_self) {
+		free(lb);
+	}
+	lb = NULL;
 	return lb;
 }
@@ -19,12 +19,30 @@ typedef struct Labeler {
 	unsigned int alloc_size;
 	unsigned int sm_thresh;
 	unsigned int b_thresh;
+	int          own_labels; /* labels is on the heap (not the caller's arena) */
+	int          own_self;   /* the Labeler itself was allocated by lb_init() */
+	/* Incremental output state, see lb_flush_to_file() */
+	unsigned int next;      /* first label not yet passed to the output */
+	Label        pending;   /* output segment that may still grow, type 0 if none */
+	int          absorb;    /* a short 'b' was merged into pending, merge the next label too if it has the same type */
+	unsigned int carry;     /* frames of a leading short 'b', added to the first segment */
+	double       start;     /* start time of pending */
+	int          tag;       /* if >= 0, printed as the first column of every segment (e.g. the stream) */
 } Labeler;
 
 Labeler* lb_init(unsigned int sm_thresh, unsigned int b_thresh);
+/* Set up lb in the caller's memory, the labels are stored in arena (arena_size
+   labels) and nothing is allocated until it is full, then they continue on
+   the heap. lb_destroy() has to be called anyway. */
+Labeler* lb_init_arena(Labeler* lb, unsigned int sm_thresh, unsigned int b_thresh, Label* arena, unsigned int arena_size);
 void     lb_add_frame(Labeler* lb, float pmusic);
 void     lb_finalize(Labeler* lb);
 void     lb_print_to_file(Labeler* lb, FILE* ofile, double frame_duration);
+/* Streaming alternative of lb_finalize() + lb_print_to_file(): print the
+   segments that the following frames can no longer change and drop them.
+   Call it after lb_add_frame() as often as needed, then once with last != 0
+   at the end of the stream. Do not mix it with lb_finalize(). */
+int      lb_flush_to_file(Labeler* lb, FILE* ofile, double frame_duration, int last);
 Labeler* lb_destroy(Labeler* lb);
 
 #endif /* _OPUS_SM_LABEL_H_ */
\ No newline at end of file
@@ -0,0 +1,234 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opus_sm_model.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define HEADER_SIZE       16
+#define LAYER_HEADER_SIZE 8
+#define NUM_FEATURES      25
+#define NUM_OUTPUTS       2
+
+static uint16_t read_u16(const uint8_t* p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_u32(const uint8_t* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t adler32(const uint8_t* data, size_t size) {
+	uint32_t a = 1;
+	uint32_t b = 0;
+	while (size > 0) {
+		/* Largest block whose sums cannot overflow before the modulo */
+		size_t block = (size < 5552) ? size : 5552;
+		size -= block;
+		while (block-- > 0) {
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+/* Parse the layer at *pos of the payload (which ends at end) into the arrays
+   of a DenseLayer or GRULayer. Return 0 on success. */
+static int parse_layer(const uint8_t* data, size_t* pos, size_t end, int type, SMLayerHeader* header,
+                       const opus_int8** bias, const opus_int8** input_weights, const opus_int8** recurrent_weights) {
+	if (end - *pos < LAYER_HEADER_SIZE) {
+		return SM_MODEL_ERR_FORMAT;
+	}
+	const uint8_t* p = &data[*pos];
+	header->type       = p[0];
+	header->sigmoid    = p[1];
+	header->nb_inputs  = read_u16(&p[2]);
+	header->nb_neurons = read_u16(&p[4]);
+	header->reserved   = read_u16(&p[6]);
+	if ((header->type != type) || (header->sigmoid > 1) || ((type == SM_LAYER_GRU) && header->sigmoid)) {
+		return SM_MODEL_ERR_FORMAT;
+	}
+	if ((header->nb_inputs < 1) || (header->nb_inputs > MAX_NEURONS) ||
+	    (header->nb_neurons < 1) || (header->nb_neurons > MAX_NEURONS)) {
+		return SM_MODEL_ERR_SHAPE;
+	}
+	size_t gates = (type == SM_LAYER_GRU) ? 3 : 1;
+	size_t columns = gates*header->nb_neurons;
+	size_t size = columns*(1 + header->nb_inputs + ((type == SM_LAYER_GRU) ? header->nb_neurons : 0));
+	size_t padded = (size + 3) & ~(size_t)3;
+	*pos += LAYER_HEADER_SIZE;
+	if (end - *pos < padded) {
+		return SM_MODEL_ERR_FORMAT;
+	}
+	const opus_int8* w = (const opus_int8*)&data[*pos];
+	*bias = w;
+	*input_weights = w + columns;
+	if (recurrent_weights != NULL) {
+		*recurrent_weights = w + columns*(1 + header->nb_inputs);
+	}
+	*pos += padded;
+	return SM_MODEL_OK;
+}
+
+/* Validate the model in data and point the layers of model into it */
+static int parse_model(SMModel* model, const uint8_t* data, size_t size) {
+	if ((size < HEADER_SIZE) || (memcmp(data, SMMODEL_MAGIC, 4) != 0) ||
+	    (read_u16(&data[4]) != SMMODEL_VERSION) || (read_u16(&data[6]) != 3)) {
+		return SM_MODEL_ERR_FORMAT;
+	}
+	uint32_t payload_size = read_u32(&data[8]);
+	if ((size - HEADER_SIZE != payload_size) || (adler32(&data[HEADER_SIZE], payload_size) != read_u32(&data[12]))) {
+		return SM_MODEL_ERR_CHECKSUM;
+	}
+
+	SMLayerHeader headers[3];
+	size_t pos = HEADER_SIZE;
+	int error = parse_layer(data, &pos, size, SM_LAYER_DENSE, &headers[0],
+	                        &model->layer0.bias, &model->layer0.input_weights, NULL);
+	if (error == SM_MODEL_OK) {
+		error = parse_layer(data, &pos, size, SM_LAYER_GRU, &headers[1],
+		                    &model->layer1.bias, &model->layer1.input_weights, &model->layer1.recurrent_weights);
+	}
+	if (error == SM_MODEL_OK) {
+		error = parse_layer(data, &pos, size, SM_LAYER_DENSE, &headers[2],
+		                    &model->layer2.bias, &model->layer2.input_weights, NULL);
+	}
+	if (error != SM_MODEL_OK) {
+		return error;
+	}
+	if (pos != size) {
+		return SM_MODEL_ERR_FORMAT;
+	}
+	if ((headers[0].nb_inputs != NUM_FEATURES) || (headers[1].nb_inputs != headers[0].nb_neurons) ||
+	    (headers[2].nb_inputs != headers[1].nb_neurons) || (headers[2].nb_neurons != NUM_OUTPUTS)) {
+		return SM_MODEL_ERR_SHAPE;
+	}
+
+	model->layer0.nb_inputs  = headers[0].nb_inputs;
+	model->layer0.nb_neurons = headers[0].nb_neurons;
+	model->layer0.sigmoid    = headers[0].sigmoid;
+	model->layer1.nb_inputs  = headers[1].nb_inputs;
+	model->layer1.nb_neurons = headers[1].nb_neurons;
+	model->layer2.nb_inputs  = headers[2].nb_inputs;
+	model->layer2.nb_neurons = headers[2].nb_neurons;
+	model->layer2.sigmoid    = headers[2].sigmoid;
+	model->mlp.layer0 = &model->layer0;
+	model->mlp.layer1 = &model->layer1;
+	model->mlp.layer2 = &model->layer2;
+	return SM_MODEL_OK;
+}
+
+SMModel* sm_model_from_memory(const void* data, size_t size, int* error) {
+	SMModel* model = (SMModel*)calloc(1, sizeof(SMModel));
+	int err = (data == NULL) ? SM_MODEL_ERR_FORMAT : parse_model(model, (const uint8_t*)data, size);
+	if (error != NULL) {
+		*error = err;
+	}
+	if (err != SM_MODEL_OK) {
+		free(model);
+		return NULL;
+	}
+	model->data = data;
+	model->size = size;
+	return model;
+}
+
+/* Read the whole file into a malloc'd buffer, for files that cannot be mapped */
+static void* read_file(FILE* fp, size_t* size) {
+	size_t alloc_size = 4096;
+	size_t count = 0;
+	uint8_t* data = (uint8_t*)malloc(alloc_size);
+	size_t n;
+	while ((n = fread(&data[count], 1, alloc_size - count, fp)) > 0) {
+		count += n;
+		if (count == alloc_size) {
+			alloc_size *= 2;
+			data = (uint8_t*)realloc(data, alloc_size);
+		}
+	}
+	if (ferror(fp)) {
+		free(data);
+		return NULL;
+	}
+	*size = count;
+	return data;
+}
+
+SMModel* sm_model_load(const char* path, int* error) {
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) {
+		if (error != NULL) {
+			*error = SM_MODEL_ERR_OPEN;
+		}
+		return NULL;
+	}
+
+	const void* data = NULL;
+	size_t size = 0;
+	int mapped = 0;
+#ifdef HAVE_SYS_MMAN_H
+	struct stat st;
+	if ((fstat(fileno(fp), &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0)) {
+		void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+		if (map != MAP_FAILED) {
+			data = map;
+			size = (size_t)st.st_size;
+			mapped = 1;
+		}
+	}
+#endif
+	if (data == NULL) {
+		data = read_file(fp, &size);
+	}
+	fclose(fp);
+	if (data == NULL) {
+		if (error != NULL) {
+			*error = SM_MODEL_ERR_OPEN;
+		}
+		return NULL;
+	}
+
+	SMModel* model = sm_model_from_memory(data, size, error);
+	if (model == NULL) {
+#ifdef HAVE_SYS_MMAN_H
+		if (mapped) {
+			munmap((void*)data, size);
+		}
+#endif
+		if (!mapped) {
+			free((void*)data);
+		}
+		return NULL;
+	}
+	model->mapped = mapped;
+	model->owned = 1;
+	return model;
+}
+
+SMModel* sm_model_destroy(SMModel* model) {
+	if (model == NULL) {
+		return NULL;
+	}
+	if (model->owned) {
+#ifdef HAVE_SYS_MMAN_H
+		if (model->mapped) {
+			munmap((void*)model->data, model->size);
+		}
+#endif
+		if (!model->mapped) {
+			free((void*)model->data);
+		}
+	}
+	free(model);
+	model = NULL;
+	return model;
+}
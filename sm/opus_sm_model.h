@@ -0,0 +1,83 @@
+/*
+ * Weights of the analysis network (see MLPModel in src/mlp.h) loaded at run
+ * time instead of the compiled-in ones, written by scripts/dump_rnn_bin.py.
+ *
+ * Binary format, little endian, meant to be mapped into memory as is:
+ *
+ *    SMModelHeader (16 bytes)
+ *    3 layers: dense, GRU, dense, each of them
+ *       SMLayerHeader (8 bytes)
+ *       bias           int8[G*nb_neurons]
+ *       input weights  int8[nb_inputs][G*nb_neurons]
+ *       recurrent      int8[nb_neurons][G*nb_neurons] (GRU only)
+ *       zero padding up to a multiple of 4 bytes
+ *    with G = 3 for the GRU (update, reset and output gates), 1 otherwise.
+ *
+ * The weights are in WEIGHTS_SCALE (1/128) units, in the layout of the
+ * DenseLayer and GRULayer arrays, which point straight into the file.
+ * checksum is the Adler-32 of everything after the header (payload_size
+ * bytes). The first layer has the 25 analysis features as inputs, the last
+ * one the 2 outputs (music and activity probabilities), each layer
+ * has as many inputs as the previous one has neurons, at most MAX_NEURONS.
+ */
+
+#ifndef _OPUS_SM_MODEL_H_
+#define _OPUS_SM_MODEL_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "src/mlp.h"
+
+#define SMMODEL_MAGIC             "SMNN"
+#define SMMODEL_VERSION           1
+
+#define SM_LAYER_DENSE            0
+#define SM_LAYER_GRU              1
+
+#define SM_MODEL_OK               0
+#define SM_MODEL_ERR_OPEN         1  /* the file cannot be opened or read */
+#define SM_MODEL_ERR_FORMAT       2  /* not a model file, or another version */
+#define SM_MODEL_ERR_CHECKSUM     3  /* truncated or corrupted */
+#define SM_MODEL_ERR_SHAPE        4  /* the layers do not fit the analysis */
+
+typedef struct SMModelHeader {
+	char     magic[4];        /* SMMODEL_MAGIC */
+	uint16_t version;         /* SMMODEL_VERSION */
+	uint16_t num_layers;      /* 3 */
+	uint32_t payload_size;    /* bytes after the header */
+	uint32_t checksum;        /* Adler-32 of the payload */
+} SMModelHeader;
+
+typedef struct SMLayerHeader {
+	uint8_t  type;            /* SM_LAYER_DENSE or SM_LAYER_GRU */
+	uint8_t  sigmoid;         /* activation of a dense layer: 1 sigmoid, 0 tanh */
+	uint16_t nb_inputs;
+	uint16_t nb_neurons;
+	uint16_t reserved;
+} SMLayerHeader;
+
+typedef struct SMModel {
+	MLPModel    mlp;          /* what the analysis uses, points to the layers below */
+	DenseLayer  layer0;
+	GRULayer    layer1;
+	DenseLayer  layer2;
+	const void* data;         /* the file contents the layers point into */
+	size_t      size;
+	int         mapped;       /* data is a mapping of the file (else malloc'd, or the caller's) */
+	int         owned;        /* data is released by sm_model_destroy() */
+} SMModel;
+
+/* Map (or read, without mmap support) and validate a model file. Return NULL
+   on error, with the SM_MODEL_ERR_* code in error (if not NULL). */
+SMModel* sm_model_load(const char* path, int* error);
+/* Validate a model that is already in memory, without copying it: data must
+   stay valid until sm_model_destroy(). */
+SMModel* sm_model_from_memory(const void* data, size_t size, int* error);
+/* The model must not be in use by any SM context anymore */
+SMModel* sm_model_destroy(SMModel* model);
+
+#endif /* _OPUS_SM_MODEL_H_ */
@@ -0,0 +1,275 @@
+#include <string.h>
+#include <stdlib.h>
+#include "opus_sm_output.h"
+#include "src/analysis.h"
+
+
+#define ALLOC_SIZE (1024)
+
+/* SMBinHeader documents the layout, which is written field by field below */
+typedef char smbin_header_size_check[(sizeof(SMBinHeader) == 64) ? 1 : -1];
+
+static const char* field_names[SM_FIELD_COUNT] = {
+	"pmusic", "vad", "tonality", "noisiness", "bandwidth", "pitch", "leak"
+};
+
+/* Number of columns of the fields */
+static int count_columns(int fields) {
+	int count = 0;
+	for (int f = 0; f < SM_FIELD_COUNT; f++) {
+		if (fields & (1 << f)) {
+			count += ((1 << f) == SM_FIELD_LEAK) ? LEAK_BANDS : 1;
+		}
+	}
+	return count;
+}
+
+SMOutput* out_init(FILE* fp, int format, int fields, int sample_rate, int channels, int frame_size, int streams) {
+	SMOutput* out = (SMOutput*)malloc(sizeof(SMOutput));
+	out->fp = fp;
+	out->format = format;
+	/* The text format always starts with the music probability */
+	out->fields = (format == SM_OUTPUT_TEXT) ? (fields | SM_FIELD_PMUSIC) : fields;
+	out->flush = 0;
+	out->sample_rate = sample_rate;
+	out->channels = channels;
+	out->frame_size = frame_size;
+	out->streams = streams;
+	out->num_columns = streams*count_columns(out->fields);
+	out->count = 0;
+	out->alloc_size = 0;
+	out->columns = (float**)calloc(out->num_columns, sizeof(float*));
+	return out;
+}
+
+/* Values of the selected fields of one frame, in column order */
+static int get_values(int fields, const AnalysisInfo* info, float* values) {
+	int count = 0;
+	if (fields & SM_FIELD_PMUSIC)    values[count++] = info->music_prob;
+	if (fields & SM_FIELD_VAD)       values[count++] = info->activity_probability;
+	if (fields & SM_FIELD_TONALITY)  values[count++] = info->tonality;
+	if (fields & SM_FIELD_NOISINESS) values[count++] = info->noisiness;
+	if (fields & SM_FIELD_BANDWIDTH) values[count++] = (float)info->bandwidth;
+	if (fields & SM_FIELD_PITCH)     values[count++] = info->max_pitch_ratio;
+	if (fields & SM_FIELD_LEAK) {
+		for (int b = 0; b < LEAK_BANDS; b++) {
+			values[count++] = info->leak_boost[b] / 64.f;
+		}
+	}
+	return count;
+}
+
+void out_frame(SMOutput* out, const AnalysisInfo* info) {
+	if (out->format == SM_OUTPUT_TEXT) {
+		fprintf(out->fp, "%f", (double)(out->count * out->frame_size) / out->sample_rate);
+		for (int s = 0; s < out->streams; s++) {
+			fprintf(out->fp, " %f", info[s].music_prob);
+			if (out->fields != SM_FIELD_PMUSIC) {
+				float values[SM_MAX_COLUMNS];
+				int count = get_values(out->fields, &info[s], values);
+				int bandwidth_column = (out->fields & SM_FIELD_BANDWIDTH) ? count_columns(out->fields & (SM_FIELD_BANDWIDTH - 1)) : -1;
+				for (int c = 1; c < count; c++) {
+					if (c == bandwidth_column) {
+						fprintf(out->fp, " %d", info[s].bandwidth);
+					} else {
+						fprintf(out->fp, " %f", values[c]);
+					}
+				}
+			}
+		}
+		fprintf(out->fp, "\n");
+		if (out->flush) {
+			fflush(out->fp);
+		}
+		out->count++;
+		return;
+	}
+
+	/* The length of the columns is only known at the end */
+	if (out->count == out->alloc_size) {
+		out->alloc_size = (out->alloc_size == 0) ? ALLOC_SIZE : 2*out->alloc_size;
+		for (int c = 0; c < out->num_columns; c++) {
+			out->columns[c] = (float*)realloc(out->columns[c], sizeof(float)*out->alloc_size);
+		}
+	}
+	int column = 0;
+	for (int s = 0; s < out->streams; s++) {
+		float values[SM_MAX_COLUMNS];
+		int count = get_values(out->fields, &info[s], values);
+		for (int c = 0; c < count; c++) {
+			out->columns[column++][out->count] = values[c];
+		}
+	}
+	out->count++;
+}
+
+static uint8_t quantize(float value) {
+	if (!(value > 0.f)) {
+		return 0;
+	}
+	if (value >= 1.f) {
+		return 255;
+	}
+	return (uint8_t)(value*255.f + 0.5f);
+}
+
+/* Quantize a column to uint8. scale is 0 for the fields in [0, 1], otherwise
+   the values are multiplied by it (back to their AnalysisInfo integers). */
+static void quantize_column(const float* values, int64_t count, float scale, uint8_t* out) {
+	for (int64_t ii = 0; ii < count; ii++) {
+		if (scale == 0.f) {
+			out[ii] = quantize(values[ii]);
+		} else {
+			float v = values[ii]*scale + 0.5f;
+			out[ii] = (v >= 255.f) ? 255 : (v <= 0.f) ? 0 : (uint8_t)v;
+		}
+	}
+}
+
+/* Little endian writers of the header fields */
+static void put_u16(uint8_t* p, uint16_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+	put_u16(p, (uint16_t)v);
+	put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put_u64(uint8_t* p, uint64_t v) {
+	put_u32(p, (uint32_t)v);
+	put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+/* The header in the byte order of the file, whatever the host's */
+static void serialize_header(const SMBinHeader* header, uint8_t* bytes) {
+	uint64_t duration;
+	memcpy(&duration, &header->frame_duration, sizeof(duration));
+	memset(bytes, 0, sizeof(SMBinHeader));
+	memcpy(bytes, header->magic, 4);
+	put_u16(bytes + 4, header->version);
+	put_u16(bytes + 6, header->header_size);
+	put_u32(bytes + 8, header->sample_rate);
+	put_u16(bytes + 12, header->channels);
+	put_u16(bytes + 14, header->value_type);
+	put_u32(bytes + 16, header->frame_size);
+	put_u32(bytes + 20, header->num_columns);
+	put_u64(bytes + 24, header->num_frames);
+	put_u64(bytes + 32, header->column_stride);
+	put_u64(bytes + 40, duration);
+	put_u32(bytes + 48, header->fields);
+	put_u16(bytes + 52, header->streams);
+}
+
+/* Write the binary header and columns, nothing to do for text. Return 0 on success. */
+int out_finish(SMOutput* out) {
+	if (out->format == SM_OUTPUT_TEXT) {
+		return ferror(out->fp);
+	}
+
+	size_t value_size = (out->format == SM_OUTPUT_UINT8) ? 1 : sizeof(float);
+	size_t column_size = (size_t)out->count * value_size;
+	size_t padding = (8 - column_size % 8) % 8;
+
+	SMBinHeader header;
+	memset(&header, 0, sizeof(SMBinHeader));
+	memcpy(header.magic, SMBIN_MAGIC, 4);
+	header.version        = SMBIN_VERSION;
+	header.header_size    = sizeof(SMBinHeader);
+	header.sample_rate    = (uint32_t)out->sample_rate;
+	header.channels       = (uint16_t)out->channels;
+	header.value_type     = (uint16_t)out->format;
+	header.frame_size     = (uint32_t)out->frame_size;
+	header.num_columns    = (uint32_t)out->num_columns;
+	header.num_frames     = (uint64_t)out->count;
+	header.column_stride  = column_size + padding;
+	header.frame_duration = (double)out->frame_size / out->sample_rate;
+	header.fields         = (uint32_t)out->fields;
+	header.streams        = (uint16_t)out->streams;
+
+	/* Columns of the integer fields, within the columns of a stream */
+	int stream_columns = out->num_columns / out->streams;
+	int bandwidth_column = (out->fields & SM_FIELD_BANDWIDTH) ? count_columns(out->fields & (SM_FIELD_BANDWIDTH - 1)) : -1;
+	int leak_column = (out->fields & SM_FIELD_LEAK) ? count_columns(out->fields & (SM_FIELD_LEAK - 1)) : -1;
+
+	uint8_t header_bytes[sizeof(SMBinHeader)];
+	serialize_header(&header, header_bytes);
+	int success = (fwrite(header_bytes, sizeof(header_bytes), 1, out->fp) == 1);
+	const uint8_t zeros[8] = {0};
+	uint8_t* quantized = (out->format == SM_OUTPUT_UINT8) ? (uint8_t*)malloc(column_size + 1) : NULL;
+	for (int c = 0; success && (c < out->num_columns); c++) {
+		const void* data = out->columns[c];
+		if (quantized != NULL) {
+			int sc = c % stream_columns;
+			float scale = (sc == bandwidth_column) ? 1.f :
+			              ((leak_column >= 0) && (sc >= leak_column) && (sc < leak_column + LEAK_BANDS)) ? 64.f : 0.f;
+			quantize_column(out->columns[c], out->count, scale, quantized);
+			data = quantized;
+		}
+		if (column_size > 0) {
+			success = (fwrite(data, 1, column_size, out->fp) == column_size);
+		}
+		if (success && (padding > 0)) {
+			success = (fwrite(zeros, 1, padding, out->fp) == padding);
+		}
+	}
+	free(quantized);
+	return !success || ferror(out->fp);
+}
+
+SMOutput* out_destroy(SMOutput* out) {
+	if (out == NULL) {
+		return out;
+	}
+	for (int c = 0; c < out->num_columns; c++) {
+		free(out->columns[c]);
+	}
+	free(out->columns);
+	free(out);
+	out = NULL;
+	return out;
+}
+
+int out_parse_format(const char* name) {
+	if (strcmp(name, "text") == 0) {
+		return SM_OUTPUT_TEXT;
+	}
+	if (strcmp(name, "f32") == 0) {
+		return SM_OUTPUT_FLOAT32;
+	}
+	if (strcmp(name, "u8") == 0) {
+		return SM_OUTPUT_UINT8;
+	}
+	return -1;
+}
+
+int out_analysis_outputs(int fields) {
+	int outputs = 0;
+	if (fields & SM_FIELD_BANDWIDTH) outputs |= ANALYSIS_BANDWIDTH;
+	if (fields & SM_FIELD_PITCH)     outputs |= ANALYSIS_MAX_PITCH;
+	if (fields & SM_FIELD_LEAK)      outputs |= ANALYSIS_LEAKAGE;
+	return outputs;
+}
+
+int out_parse_fields(const char* list) {
+	int fields = 0;
+	while (*list != '\0') {
+		size_t len = strcspn(list, ",");
+		int found = 0;
+		for (int f = 0; f < SM_FIELD_COUNT; f++) {
+			if ((strlen(field_names[f]) == len) && (strncmp(list, field_names[f], len) == 0)) {
+				fields |= (1 << f);
+				found = 1;
+			}
+		}
+		if (!found) {
+			return -1;
+		}
+		list += len;
+		if (*list == ',') {
+			list++;
+		}
+	}
+	return fields;
+}
@@ -0,0 +1,100 @@
+/*
+ * Framewise output of the SM analysis: the music probability text format
+ * ("<time> <pmusic>" per line, followed by the selected extra fields, then
+ * the same for the next stream, if any) or a binary columnar format.
+ *
+ * Binary format, little endian, meant to be mapped into memory as is:
+ *
+ *    SMBinHeader (64 bytes, header_size)
+ *    one column of num_frames values for each field set in fields, in the
+ *    order of the SM_FIELD_* bits (SM_FIELD_LEAK gives LEAK_BANDS columns),
+ *    repeated for each of the streams (all columns of stream 0 first)
+ *
+ * Values are float32, or uint8: bandwidth (band index) and leak (Q6 boost)
+ * are stored as they are in AnalysisInfo, the others (probabilities,
+ * tonality, ...) as q/255.
+ * Column c starts at header_size + c*column_stride, column_stride is
+ * num_frames*value size rounded up to a multiple of 8 (the padding is zero).
+ * Frame i starts at i*frame_duration seconds.
+ * The columns are buffered and written by out_finish(), so the binary
+ * formats are only for input of known length (not for live streams).
+ */
+
+#ifndef _OPUS_SM_OUTPUT_H_
+#define _OPUS_SM_OUTPUT_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include "celt.h"
+
+#define SM_OUTPUT_TEXT           0
+#define SM_OUTPUT_FLOAT32        1
+#define SM_OUTPUT_UINT8          2
+
+/* Fields of AnalysisInfo, in output order */
+#define SM_FIELD_PMUSIC          (1 << 0)  /* music_prob */
+#define SM_FIELD_VAD             (1 << 1)  /* activity_probability */
+#define SM_FIELD_TONALITY        (1 << 2)  /* tonality */
+#define SM_FIELD_NOISINESS       (1 << 3)  /* noisiness */
+#define SM_FIELD_BANDWIDTH       (1 << 4)  /* bandwidth, index of the highest band with energy (0-20) */
+#define SM_FIELD_PITCH           (1 << 5)  /* max_pitch_ratio */
+#define SM_FIELD_LEAK            (1 << 6)  /* leak_boost[LEAK_BANDS], log2 units (Q6 in uint8) */
+#define SM_FIELD_COUNT           7
+/* Columns of one stream */
+#define SM_MAX_COLUMNS           (SM_FIELD_COUNT - 1 + LEAK_BANDS)
+
+#define SM_FIELDS_TEXT_DEFAULT   (SM_FIELD_PMUSIC)
+#define SM_FIELDS_BINARY_DEFAULT (SM_FIELD_PMUSIC | SM_FIELD_VAD | SM_FIELD_TONALITY)
+
+#define SMBIN_MAGIC              "SMBF"
+#define SMBIN_VERSION            1
+
+typedef struct SMBinHeader {
+	char     magic[4];        /* SMBIN_MAGIC */
+	uint16_t version;         /* SMBIN_VERSION */
+	uint16_t header_size;     /* offset of the first column */
+	uint32_t sample_rate;     /* of the input */
+	uint16_t channels;        /* of the input */
+	uint16_t value_type;      /* SM_OUTPUT_FLOAT32 or SM_OUTPUT_UINT8 */
+	uint32_t frame_size;      /* input samples per frame */
+	uint32_t num_columns;
+	uint64_t num_frames;
+	uint64_t column_stride;   /* bytes from one column to the next */
+	double   frame_duration;  /* seconds */
+	uint32_t fields;          /* SM_FIELD_* bits, one column per field (LEAK_BANDS for leak) */
+	uint16_t streams;         /* analyzed streams, num_columns/streams columns each */
+	uint8_t  reserved[10];
+} SMBinHeader;
+
+typedef struct SMOutput {
+	FILE*    fp;
+	int      format;
+	int      fields;
+	int      flush;           /* flush every text line (streaming) */
+	int      sample_rate;
+	int      channels;
+	int      frame_size;
+	int      streams;
+	int      num_columns;     /* of all streams */
+	int64_t  count;           /* frames written */
+	int64_t  alloc_size;
+	float**  columns;         /* binary formats are written by out_finish() */
+} SMOutput;
+
+SMOutput* out_init(FILE* fp, int format, int fields, int sample_rate, int channels, int frame_size, int streams);
+/* info holds the results of the frame for every stream */
+void      out_frame(SMOutput* out, const AnalysisInfo* info);
+int       out_finish(SMOutput* out);
+SMOutput* out_destroy(SMOutput* out);
+/* Parse a format name (text, f32, u8), return -1 if it is unknown */
+int       out_parse_format(const char* name);
+/* Parse a comma separated field list (vad,tonality,noisiness,bandwidth,pitch,leak), return -1 on error */
+int       out_parse_fields(const char* list);
+/* Analysis results the fields need, for sm_set_analysis_outputs() */
+int       out_analysis_outputs(int fields);
+
+#endif /* _OPUS_SM_OUTPUT_H_ */
@@ -0,0 +1,189 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <pthread.h>
+#include "opus_sm_pcm.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PCM_X86_AVX2
+#if defined(__SSE2__)
+#define PCM_X86_SSE2
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PCM_ARM_NEON
+#endif
+
+#define S16_SCALE (1.f/32768)
+#define S24_SCALE (1.f/8388608)
+
+/* Samples that the SIMD loops leave, and the plain C versions */
+static void s16_to_float_c(float* out, const int16_t* in, size_t count) {
+	for (size_t ii = 0; ii < count; ii++) {
+		out[ii] = (float)in[ii]*S16_SCALE;
+	}
+}
+
+static void s24_to_float_c(float* out, const uint8_t* in, size_t count) {
+	for (size_t ii = 0; ii < count; ii++) {
+		/* Sign extend from the top byte */
+		int32_t v = (int32_t)((uint32_t)in[3*ii] << 8 | (uint32_t)in[3*ii+1] << 16 | (uint32_t)in[3*ii+2] << 24) >> 8;
+		out[ii] = (float)v*S24_SCALE;
+	}
+}
+
+#ifdef PCM_X86_AVX2
+__attribute__((target("avx2")))
+static void s16_to_float_avx2(float* out, const int16_t* in, size_t count) {
+	const __m256 scale = _mm256_set1_ps(S16_SCALE);
+	size_t ii = 0;
+	for (; ii + 16 <= count; ii += 16) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)&in[ii]);
+		__m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(x));
+		__m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(x, 1));
+		_mm256_storeu_ps(&out[ii], _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+		_mm256_storeu_ps(&out[ii + 8], _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+	}
+	s16_to_float_c(&out[ii], &in[ii], count - ii);
+}
+
+/* 4 samples of 3 bytes per 128 bit lane, moved to the top of 32 bit words
+   and shifted back down with their sign */
+__attribute__((target("avx2")))
+static void s24_to_float_avx2(float* out, const uint8_t* in, size_t count) {
+	const __m256i shuffle = _mm256_setr_epi8(
+		-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+		-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+	const __m256 scale = _mm256_set1_ps(S24_SCALE);
+	size_t ii = 0;
+	/* The second lane reads 16 bytes from sample ii + 4, 4 more than it uses */
+	for (; ii + 10 <= count; ii += 8) {
+		__m128i lo = _mm_loadu_si128((const __m128i*)&in[3*ii]);
+		__m128i hi = _mm_loadu_si128((const __m128i*)&in[3*ii + 12]);
+		__m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		x = _mm256_srai_epi32(_mm256_shuffle_epi8(x, shuffle), 8);
+		_mm256_storeu_ps(&out[ii], _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+	}
+	s24_to_float_c(&out[ii], &in[3*ii], count - ii);
+}
+
+/* Detected once for the process, the converters are called from many threads */
+static int avx2;
+static pthread_once_t avx2_once = PTHREAD_ONCE_INIT;
+
+static void detect_avx2(void) {
+	__builtin_cpu_init();
+	avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+}
+
+static int have_avx2(void) {
+	pthread_once(&avx2_once, detect_avx2);
+	return avx2;
+}
+#endif
+
+#ifdef PCM_X86_SSE2
+static void s16_to_float_sse2(float* out, const int16_t* in, size_t count) {
+	const __m128 scale = _mm_set1_ps(S16_SCALE);
+	size_t ii = 0;
+	for (; ii + 8 <= count; ii += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i*)&in[ii]);
+		/* Each sample in the top half of a 32 bit word, then sign extended */
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(&out[ii], _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(&out[ii + 4], _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	s16_to_float_c(&out[ii], &in[ii], count - ii);
+}
+#endif
+
+#ifdef PCM_ARM_NEON
+static void s16_to_float_neon(float* out, const int16_t* in, size_t count) {
+	size_t ii = 0;
+	for (; ii + 8 <= count; ii += 8) {
+		int16x8_t x = vld1q_s16(&in[ii]);
+		vst1q_f32(&out[ii], vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), S16_SCALE));
+		vst1q_f32(&out[ii + 4], vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), S16_SCALE));
+	}
+	s16_to_float_c(&out[ii], &in[ii], count - ii);
+}
+
+/* vld3 splits 16 samples into their low, middle and (signed) high bytes */
+static void s24_to_float_neon(float* out, const uint8_t* in, size_t count) {
+	size_t ii = 0;
+	for (; ii + 16 <= count; ii += 16) {
+		uint8x16x3_t b = vld3q_u8(&in[3*ii]);
+		uint16x8_t low[2], high[2];
+		low[0] = vorrq_u16(vmovl_u8(vget_low_u8(b.val[0])), vshll_n_u8(vget_low_u8(b.val[1]), 8));
+		low[1] = vorrq_u16(vmovl_u8(vget_high_u8(b.val[0])), vshll_n_u8(vget_high_u8(b.val[1]), 8));
+		high[0] = vreinterpretq_u16_s16(vmovl_s8(vget_low_s8(vreinterpretq_s8_u8(b.val[2]))));
+		high[1] = vreinterpretq_u16_s16(vmovl_s8(vget_high_s8(vreinterpretq_s8_u8(b.val[2]))));
+		for (int k = 0; k < 2; k++) {
+			int32x4_t v0 = vreinterpretq_s32_u32(vorrq_u32(vshll_n_u16(vget_low_u16(high[k]), 16), vmovl_u16(vget_low_u16(low[k]))));
+			int32x4_t v1 = vreinterpretq_s32_u32(vorrq_u32(vshll_n_u16(vget_high_u16(high[k]), 16), vmovl_u16(vget_high_u16(low[k]))));
+			vst1q_f32(&out[ii + 8*k], vmulq_n_f32(vcvtq_f32_s32(v0), S24_SCALE));
+			vst1q_f32(&out[ii + 8*k + 4], vmulq_n_f32(vcvtq_f32_s32(v1), S24_SCALE));
+		}
+	}
+	s24_to_float_c(&out[ii], &in[3*ii], count - ii);
+}
+#endif
+
+static void s16_to_float(float* out, const int16_t* in, size_t count) {
+#if defined(PCM_X86_AVX2)
+	if (have_avx2()) {
+		s16_to_float_avx2(out, in, count);
+		return;
+	}
+#endif
+#if defined(PCM_X86_SSE2)
+	s16_to_float_sse2(out, in, count);
+#elif defined(PCM_ARM_NEON)
+	s16_to_float_neon(out, in, count);
+#else
+	s16_to_float_c(out, in, count);
+#endif
+}
+
+static void s24_to_float(float* out, const uint8_t* in, size_t count) {
+#if defined(PCM_X86_AVX2)
+	if (have_avx2()) {
+		s24_to_float_avx2(out, in, count);
+		return;
+	}
+#endif
+#if defined(PCM_ARM_NEON)
+	s24_to_float_neon(out, in, count);
+#else
+	s24_to_float_c(out, in, count);
+#endif
+}
+
+int pcm_sample_size(int format) {
+	switch (format) {
+	case PCM_S16: return 2;
+	case PCM_S24: return 3;
+	case PCM_F32: return 4;
+	default:      return 0;
+	}
+}
+
+void pcm_to_float(float* out, const void* in, int format, size_t count) {
+	switch (format) {
+	case PCM_S16:
+		s16_to_float(out, (const int16_t*)in, count);
+		break;
+	case PCM_S24:
+		s24_to_float(out, (const uint8_t*)in, count);
+		break;
+	case PCM_F32:
+		if (out != (const float*)in) {
+			memcpy(out, in, sizeof(float)*count);
+		}
+		break;
+	}
+}
@@ -0,0 +1,33 @@
+/*
+ * PCM sample conversion to float, shared by the WAVE reader and the SM
+ * front end. Integer samples get the scaling of the Opus API: 1/32768 for
+ * 16 bit (opus_encode()) and 1/8388608 for 24 bit (opus_encode24()), so a
+ * full scale integer signal and the same signal in float give the same
+ * analysis.
+ *
+ * The conversions use SSE2 or AVX2 (chosen at run time) on x86 and NEON on
+ * ARM when the compiler supports them, plain C otherwise. The results are
+ * the same in all cases.
+ */
+
+#ifndef _OPUS_SM_PCM_H_
+#define _OPUS_SM_PCM_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Sample formats */
+#define PCM_S16                  0  /* int16_t, native byte order */
+#define PCM_S24                  1  /* packed 3 byte little endian */
+#define PCM_F32                  2  /* float, native byte order, full scale is [-1, 1] */
+
+/* Bytes per sample of a format, 0 if it is unknown */
+int  pcm_sample_size(int format);
+/* Convert count samples (interleaved or not, it does not matter) */
+void pcm_to_float(float* out, const void* in, int format, size_t count);
+
+#endif /* _OPUS_SM_PCM_H_ */
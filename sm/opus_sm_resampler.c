@@ -0,0 +1,155 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opus_sm_resampler.h"
+
+#ifndef M_PI
+#define M_PI 3.141592653
+#endif
+
+/* Zero crossings of the sinc on each side, and the cutoff relative to the
+   lower of the two Nyquist frequencies. The analysis does not look above
+   12 kHz at all, so a short filter with some aliasing near the cutoff is fine. */
+#define ZERO_CROSSINGS 8
+#define ROLLOFF        0.95
+
+static int gcd(int a, int b) {
+	while (b != 0) {
+		int tmp = a % b;
+		a = b;
+		b = tmp;
+	}
+	return a;
+}
+
+/* Blackman windowed sinc, t in input samples, fc relative to the input Nyquist */
+static double kernel(double t, double fc, int half) {
+	if (fabs(t) >= half) {
+		return 0;
+	}
+	double x = M_PI * fc * t;
+	double sinc = (fabs(x) < 1e-9) ? 1.0 : sin(x) / x;
+	double window = 0.42 + 0.5*cos(M_PI * t / half) + 0.08*cos(2*M_PI * t / half);
+	return fc * sinc * window;
+}
+
+/* Reduce the ratio to num/den and get the cutoff and half length of the filter */
+static void rs_design(int fs_in, int fs_out, int* num, int* den, double* fc, int* half) {
+	int g = gcd(fs_in, fs_out);
+	*num = fs_out / g;
+	*den = fs_in / g;
+	*fc = ROLLOFF * ((*num < *den) ? (double)*num / *den : 1.0);
+	*half = (int)ceil(ZERO_CROSSINGS / *fc);
+}
+
+long long rs_filter_size(int fs_in, int fs_out) {
+	if ((fs_in <= 0) || (fs_out <= 0)) {
+		return 0;
+	}
+	int num, den, half;
+	double fc;
+	rs_design(fs_in, fs_out, &num, &den, &fc, &half);
+	return (long long)num * 2*half;
+}
+
+Resampler* rs_init(int fs_in, int fs_out, int frame_size) {
+	if ((fs_in <= 0) || (fs_out <= 0) || (frame_size <= 0)) {
+		return NULL;
+	}
+	int num, den, half;
+	double fc;
+	rs_design(fs_in, fs_out, &num, &den, &fc, &half);
+	/* Every frame has to give a whole number of output samples */
+	if (((long long)frame_size * num) % den != 0) {
+		return NULL;
+	}
+	if (rs_filter_size(fs_in, fs_out) > RS_MAX_FILTER_SIZE) {
+		return NULL;
+	}
+
+	Resampler* rs = (Resampler*)malloc(sizeof(Resampler));
+	if (rs == NULL) {
+		return NULL;
+	}
+	rs->num = num;
+	rs->den = den;
+	rs->taps = 2*half;
+	rs->frame_size = frame_size;
+	rs->filter = (float*)malloc(sizeof(float)*num*rs->taps);
+	rs->buf = (float*)malloc(sizeof(float)*(rs->taps + frame_size));
+	if ((rs->filter == NULL) || (rs->buf == NULL)) {
+		return rs_destroy(rs);
+	}
+
+	/* Phase p is centered p/num input samples after tap half-1. Each phase is
+	   normalized to unity DC gain. */
+	for (int p = 0; p < num; p++) {
+		float* f = &rs->filter[p*rs->taps];
+		double sum = 0;
+		for (int k = 0; k < rs->taps; k++) {
+			double t = (double)(k - (half - 1)) - (double)p / num;
+			f[k] = (float)kernel(t, fc, half);
+			sum += f[k];
+		}
+		for (int k = 0; k < rs->taps; k++) {
+			f[k] = (float)(f[k] / sum);
+		}
+	}
+
+	rs_reset(rs);
+	return rs;
+}
+
+void rs_reset(Resampler* rs) {
+	if (rs == NULL) {
+		return;
+	}
+	/* taps-1 samples of zero padding: with it the first frame already gives
+	   the full rs_output_size() samples. */
+	rs->buf_fill = rs->taps - 1;
+	memset(rs->buf, 0, sizeof(float)*rs->buf_fill);
+	rs->pos = 0;
+	rs->phase = 0;
+}
+
+int rs_output_size(Resampler* rs) {
+	return (int)(((long long)rs->frame_size * rs->num) / rs->den);
+}
+
+/* Resample one frame of frame_size samples, return the number of output
+   samples, which is always rs_output_size(). */
+int rs_process(Resampler* rs, const float* in, float* out) {
+	int count = 0;
+	memcpy(&rs->buf[rs->buf_fill], in, sizeof(float)*rs->frame_size);
+	rs->buf_fill += rs->frame_size;
+
+	while (rs->pos + rs->taps <= rs->buf_fill) {
+		const float* f = &rs->filter[rs->phase*rs->taps];
+		const float* x = &rs->buf[rs->pos];
+		float sum = 0;
+		for (int k = 0; k < rs->taps; k++) {
+			sum += f[k]*x[k];
+		}
+		out[count++] = sum;
+		rs->phase += rs->den;
+		rs->pos += rs->phase / rs->num;
+		rs->phase %= rs->num;
+	}
+
+	/* Keep only the history the next output needs */
+	rs->buf_fill -= rs->pos;
+	memmove(rs->buf, &rs->buf[rs->pos], sizeof(float)*rs->buf_fill);
+	rs->pos = 0;
+	return count;
+}
+
+Resampler* rs_destroy(Resampler* rs) {
+	if (rs == NULL) {
+		return rs;
+	}
+	free(rs->filter);
+	free(rs->buf);
+	free(rs);
+	rs = NULL;
+	return rs;
+}
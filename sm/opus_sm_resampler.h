@@ -0,0 +1,47 @@
+/*
+ * Streaming rational resampler of the SM front-end.
+ *
+ * It converts mono float input of any sample rate to the 24 kHz rate of the
+ * tonality analysis (see tonality_analysis() in src/analysis.c). It is a
+ * windowed-sinc polyphase filter: the ratio is reduced to out/in = num/den and
+ * one filter phase is precomputed for each of the num output positions.
+ * The input is delayed so that every input frame of frame_size samples
+ * produces exactly frame_size*num/den output samples, from the first frame on.
+ * Rates whose ratio does not reduce (e.g. 191999 Hz) would need tens of
+ * thousands of phases, so the table is limited to RS_MAX_FILTER_SIZE floats.
+ */
+
+#ifndef _OPUS_SM_RESAMPLER_H_
+#define _OPUS_SM_RESAMPLER_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* Largest polyphase table, in floats (1 MB). The usual rates need a few
+   thousand: 2560 for 44.1 kHz, 5760 for 11.025 kHz. */
+#define RS_MAX_FILTER_SIZE (1 << 18)
+
+typedef struct Resampler {
+	int    num;          /* output/input ratio is num/den */
+	int    den;
+	int    taps;         /* filter length of one phase (2*half length) */
+	int    frame_size;   /* input samples per rs_process() call */
+	float* filter;       /* [num][taps] */
+	float* buf;          /* padded input history */
+	int    buf_fill;
+	int    pos;          /* buffer index of the next output's first tap */
+	int    phase;        /* fractional position of the next output, in 1/num units */
+} Resampler;
+
+/* Size of the polyphase table (num*taps floats) from fs_in to fs_out, 0 for invalid rates */
+long long  rs_filter_size(int fs_in, int fs_out);
+/* NULL for invalid rates, a frame_size without a whole number of output
+   samples, a table larger than RS_MAX_FILTER_SIZE or an allocation failure */
+Resampler* rs_init(int fs_in, int fs_out, int frame_size);
+void       rs_reset(Resampler* rs);
+int        rs_output_size(Resampler* rs);
+int        rs_process(Resampler* rs, const float* in, float* out);
+Resampler* rs_destroy(Resampler* rs);
+
+#endif /* _OPUS_SM_RESAMPLER_H_ */
@@ -1,7 +1,16 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "wavfile.h"
+#include "opus_sm_pcm.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 int is_equal_char_arr(const char* arr, const char* reference, const uint32_t length) {
 	uint32_t ii;
@@ -13,16 +22,61 @@ int is_equal_char_arr(const char* arr, const char* reference, const uint32_t len
 
 int is_valid_header(const WAVEHeader header) {
 	int result = 1;
-	result = result & is_equal_char_arr((char*)&header.ChunkID,     "RIFF", 4);
+	result = result & (is_equal_char_arr((char*)&header.ChunkID, "RIFF", 4) |
+	                   is_equal_char_arr((char*)&header.ChunkID, "RF64", 4) |
+	                   is_equal_char_arr((char*)&header.ChunkID, "BW64", 4));
 	result = result & is_equal_char_arr((char*)&header.Format,      "WAVE", 4);
 	result = result & is_equal_char_arr((char*)&header.Subchunk1ID, "fmt ", 4);
 	result = result & is_equal_char_arr((char*)&header.Subchunk2ID, "data", 4);
 	result = result & ((header.BitsPerSample % 8) == 0);
+	result = result & (header.NumChannels > 0);
+	result = result & (header.BlockAlign == header.NumChannels * (header.BitsPerSample / 8));
+	return result;
+}
+
+int is_supported_format(int format, int bits) {
+	if (format == WAVE_FORMAT_PCM) {
+		return (bits == 8) || (bits == 16) || (bits == 24) || (bits == 32);
+	}
+	if (format == WAVE_FORMAT_IEEE_FLOAT) {
+		return (bits == 32) || (bits == 64);
+	}
+	return 0;
+}
 
-	/* Only 16 bits samples are supported at the moment */
-	result = result & ((header.BitsPerSample == 16));
+/* Little endian field readers of the chunk parser */
+static uint16_t get_u16(const uint8_t* p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
 
-	return result;
+static uint32_t get_u32(const uint8_t* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_u64(const uint8_t* p) {
+	return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+/* The 16 bit and float samples of the file can be used as int16_t and float */
+static int host_is_little_endian(void) {
+	const uint16_t one = 1;
+	return *(const uint8_t*)&one;
+}
+
+/* Skip count bytes of the input. Seek when possible, read and drop otherwise (pipes). */
+static int skip_bytes(FILE* fp, uint64_t count) {
+	uint8_t scratch[4096];
+	if ((count <= 0x7FFFFFFF) && (fseek(fp, (long)count, SEEK_CUR) == 0)) {
+		return 1;
+	}
+	while (count > 0) {
+		size_t len = (count < sizeof(scratch)) ? (size_t)count : sizeof(scratch);
+		if (fread(scratch, 1, len, fp) != len) {
+			return 0;
+		}
+		count -= len;
+	}
+	return 1;
 }
 
 int wcopy_header(WAVE* src, WAVE* dest) {
@@ -48,16 +102,33 @@ int frame_size_bytes(WAVE* wave, int frame_num) {
 	return frame_num*wave->header.NumChannels*(wave->header.BitsPerSample/8);
 }
 
+/* Byte offset of a frame inside the data chunk, does not overflow on files over 2 GB */
+static size_t frame_offset_bytes(WAVE* wave, int64_t frame_num) {
+	return (size_t)frame_num * wave->header.NumChannels * (wave->header.BitsPerSample/8);
+}
+
 WAVE* wopen(const char* fname, const char* mode) {
 	WAVE* wave = (WAVE*)malloc(sizeof(WAVE));
 	wave->fp = NULL;
 	char open_mode[3] = "?b";
 	open_mode[0] = mode[0];
-	wave->fp = fopen(fname, open_mode);
+	if (strcmp(fname, "-") == 0) {
+		wave->fp = (mode[0] == 'r') ? stdin : stdout;
+	} else {
+		wave->fp = fopen(fname, open_mode);
+	}
 	if (wave->fp != NULL) {
 		wave->mode = mode[0];
 		wave->header_init_done = 0;
 		wave->size = 0;
+		wave->format = WAVE_FORMAT_PCM;
+		wave->data_size = 0;
+		wave->data_offset = 0;
+		wave->scratch = NULL;
+		wave->scratch_size = 0;
+		wave->map = NULL;
+		wave->map_size = 0;
+		wave->pos = 0;
 		wave->error = WAVE_OK;
 	} else {
 		free(wave);
@@ -70,45 +141,102 @@ WAVE* wclose(WAVE* wave) {
 	if (wave != NULL) {
 		// Rewrite header in write mode, to store size
 		if (wave->mode == 'w') {
-			wave->header.Subchunk2Size = wave->size * wave->header.NumChannels * (wave->header.BitsPerSample/8); // NumSamples * NumChannels * BitsPerSample/8
+			wave->header.Subchunk2Size = (uint32_t)wave->size * wave->header.NumChannels * (wave->header.BitsPerSample/8); // NumSamples * NumChannels * BitsPerSample/8
 			fseek(wave->fp, 0 , SEEK_SET);
 			wave->header_init_done = 0;
 			wsetheader(wave);
 		}
-		fclose(wave->fp);
+#ifdef HAVE_SYS_MMAN_H
+		if (wave->map != NULL) {
+			munmap((void*)wave->map, wave->map_size);
+		}
+#endif
+		if ((wave->fp != stdin) && (wave->fp != stdout)) {
+			fclose(wave->fp);
+		}
+		free(wave->scratch);
 		free(wave);
 		wave = NULL;
 	}
 	return wave;
 }
 
+/* Walk the RIFF chunks up to the "data" chunk. Chunks other than "fmt " and
+   "ds64" are skipped. The input is read strictly forward, so it works on pipes. */
 int wgetheader(WAVE* wave) {
 	if (wave == NULL) return WAVE_ERR_NULL_HANDLER;
 	if (wave->error == WAVE_ERR_HEADER_NOT_INITIALIZED) wave->error = WAVE_OK;
 	if (wave->mode != 'r') wave->error = WAVE_ERR_READ_MODE_EXPECTED;
 	if (wave->header_init_done != 0) wave->error = WAVE_ERR_HEADER_ALREADY_INITIALIZED;
 	if (wave->error != WAVE_OK) return wave->error;
-	int success = 1;
-	success = success & fread(&wave->header.ChunkID,       4*sizeof(uint8_t),  1, wave->fp);
-	success = success & fread(&wave->header.ChunkSize,      sizeof(uint32_t),  1, wave->fp);
-	success = success & fread(&wave->header.Format,        4*sizeof(uint8_t),  1, wave->fp);
 
-	// Subchunk "fmt "
-	success = success & fread(&wave->header.Subchunk1ID,   4*sizeof(uint8_t),  1, wave->fp);
-	success = success & fread(&wave->header.Subchunk1Size,  sizeof(uint32_t),  1, wave->fp);
-	success = success & fread(&wave->header.AudioFormat,    sizeof(uint16_t),  1, wave->fp);
-	success = success & fread(&wave->header.NumChannels,    sizeof(uint16_t),  1, wave->fp);
-	success = success & fread(&wave->header.SampleRate,     sizeof(uint32_t),  1, wave->fp);
-	success = success & fread(&wave->header.ByteRate,       sizeof(uint32_t),  1, wave->fp);
-	success = success & fread(&wave->header.BlockAlign,     sizeof(uint16_t),  1, wave->fp);
-	success = success & fread(&wave->header.BitsPerSample,  sizeof(uint16_t),  1, wave->fp);
+	uint8_t  chunk[40];
+	uint64_t offset = 12;
+	uint64_t ds64_data_size = 0;
+	int      have_fmt = 0;
+	int      success = (fread(chunk, 12, 1, wave->fp) == 1);
+	if (success) {
+		memcpy(wave->header.ChunkID, chunk, 4);
+		wave->header.ChunkSize = get_u32(chunk + 4);
+		memcpy(wave->header.Format, chunk + 8, 4);
+	}
+	int is_rf64 = success && (is_equal_char_arr((char*)chunk, "RF64", 4) || is_equal_char_arr((char*)chunk, "BW64", 4));
 
-	// Subchunk "data"
-	success = success & fread(&wave->header.Subchunk2ID,   4*sizeof(uint8_t),  1, wave->fp);
-	success = success & fread(&wave->header.Subchunk2Size,  sizeof(uint32_t),  1, wave->fp);
+	while (success) {
+		success = (fread(chunk, 8, 1, wave->fp) == 1);
+		if (!success) break;
+		uint32_t size = get_u32(chunk + 4);
+		uint64_t padded_size = (uint64_t)size + (size & 1);
+		offset += 8;
+
+		if (is_equal_char_arr((char*)chunk, "data", 4)) {
+			memcpy(wave->header.Subchunk2ID, chunk, 4);
+			wave->header.Subchunk2Size = size;
+			wave->data_size = (is_rf64 && (size == 0xFFFFFFFF)) ? ds64_data_size : size;
+			wave->data_offset = (long)offset;
+			break;
+		}
+
+		if (is_equal_char_arr((char*)chunk, "fmt ", 4) && (size >= 16)) {
+			/* WAVEFORMATEX is 18 bytes, WAVEFORMATEXTENSIBLE is 40 bytes */
+			uint32_t len = (size < sizeof(chunk)) ? size : sizeof(chunk);
+			success = (fread(chunk, len, 1, wave->fp) == 1) && skip_bytes(wave->fp, padded_size - len);
+			memcpy(wave->header.Subchunk1ID, "fmt ", 4);
+			wave->header.Subchunk1Size = size;
+			wave->header.AudioFormat   = get_u16(chunk);
+			wave->header.NumChannels   = get_u16(chunk + 2);
+			wave->header.SampleRate    = get_u32(chunk + 4);
+			wave->header.ByteRate      = get_u32(chunk + 8);
+			wave->header.BlockAlign    = get_u16(chunk + 12);
+			wave->header.BitsPerSample = get_u16(chunk + 14);
+			wave->format = wave->header.AudioFormat;
+			if ((wave->format == WAVE_FORMAT_EXTENSIBLE) && (len >= 26)) {
+				/* The first two bytes of the SubFormat GUID are the format code */
+				wave->format = get_u16(chunk + 24);
+			}
+			have_fmt = 1;
+		} else if (is_equal_char_arr((char*)chunk, "ds64", 4) && (size >= 24)) {
+			/* RIFF size, data size, sample count, then an optional table */
+			success = (fread(chunk, 24, 1, wave->fp) == 1) && skip_bytes(wave->fp, padded_size - 24);
+			ds64_data_size = get_u64(chunk + 8);
+		} else {
+			/* LIST, bext, fact, cue, junk, ... */
+			success = skip_bytes(wave->fp, padded_size);
+		}
+		offset += padded_size;
+	}
 
-	if ((success == 1) && (is_valid_header(wave->header))) {
-		wave->size = wave->header.Subchunk2Size / ((wave->header.BitsPerSample / 8) * wave->header.NumChannels);
+	if (success && have_fmt && is_valid_header(wave->header)) {
+		if (!is_supported_format(wave->format, wave->header.BitsPerSample)) {
+			wave->error = WAVE_ERR_UNSUPPORTED_FORMAT;
+			return wave->error;
+		}
+		wave->size = (int64_t)(wave->data_size / wave->header.BlockAlign);
+		/* Writers that can't seek back put a placeholder into the data size */
+		if ((wave->header.Subchunk2Size == 0xFFFFFFFF && !is_rf64) ||
+		    (wave->data_size == 0 && ftell(wave->fp) < 0)) {
+			wave->size = WAVE_SIZE_UNKNOWN;
+		}
 		wave->header_init_done = 1;
 		wave->error = WAVE_OK;
 	} else {
@@ -118,16 +246,222 @@ int wgetheader(WAVE* wave) {
 
 }
 
-int wread(int16_t* buf, int framenum, WAVE* wave) {
+/* Describe headerless PCM input instead of reading a header with
+   wgetheader(). The data starts at the current position and runs up to
+   the end of the stream. */
+int wrawheader(WAVE* wave, uint32_t samplerate, uint16_t channels, uint16_t bits, int format) {
+	if (wave == NULL) return WAVE_ERR_NULL_HANDLER;
+	if (wave->mode != 'r') wave->error = WAVE_ERR_READ_MODE_EXPECTED;
+	if (wave->header_init_done != 0) wave->error = WAVE_ERR_HEADER_ALREADY_INITIALIZED;
+	if (wave->error != WAVE_OK) return wave->error;
+	if ((channels == 0) || !is_supported_format(format, bits)) {
+		wave->error = WAVE_ERR_UNSUPPORTED_FORMAT;
+		return wave->error;
+	}
+
+	memcpy(wave->header.ChunkID, "RIFF", 4);
+	wave->header.ChunkSize     = 0;
+	memcpy(wave->header.Format, "WAVE", 4);
+	memcpy(wave->header.Subchunk1ID, "fmt ", 4);
+	wave->header.Subchunk1Size = 16;
+	wave->header.AudioFormat   = (uint16_t)format;
+	wave->header.NumChannels   = channels;
+	wave->header.SampleRate    = samplerate;
+	wave->header.BlockAlign    = (uint16_t)(channels * (bits / 8));
+	wave->header.ByteRate      = samplerate * wave->header.BlockAlign;
+	wave->header.BitsPerSample = bits;
+	memcpy(wave->header.Subchunk2ID, "data", 4);
+	wave->header.Subchunk2Size = 0xFFFFFFFF;
+	wave->format = format;
+	wave->data_size = 0;
+	long offset = ftell(wave->fp);
+	wave->data_offset = (offset > 0) ? offset : 0;
+	wave->size = WAVE_SIZE_UNKNOWN;
+	wave->header_init_done = 1;
+	return wave->error;
+}
+
+/* Read framenum raw frames. When the file is mapped *data points into the
+   mapping, otherwise the frames are read into buf and *data points to buf. */
+static int wview_raw(WAVE* wave, int framenum, uint8_t* buf, const uint8_t** data) {
+	*data = NULL;
 	if (wave == NULL) return 0;
 	if (wave->error == WAVE_ERR_HEADER_ALREADY_INITIALIZED) wave->error = WAVE_OK;
 	if (wave->mode != 'r') wave->error = WAVE_ERR_READ_MODE_EXPECTED;
 	if (wave->header_init_done != 1) wave->error = WAVE_ERR_HEADER_NOT_INITIALIZED;
 	if (wave->error != WAVE_OK) return 0;
-	int result = fread(buf, (wave->header.BitsPerSample / 8)*wave->header.NumChannels, framenum, wave->fp);
+	if (wave->map == NULL) {
+		/* Don't read into the chunks after the data, unless its size is unknown */
+		if ((wave->size != WAVE_SIZE_UNKNOWN) && (wave->size - wave->pos < framenum)) {
+			framenum = (int)(wave->size - wave->pos);
+		}
+		*data = buf;
+		int result = fread(buf, wave->header.BlockAlign, framenum, wave->fp);
+		wave->pos += result;
+		return result;
+	}
+	int64_t result = wave->size - wave->pos;
+	if (result > framenum) {
+		result = framenum;
+	}
+	*data = wave->map + wave->data_offset + frame_offset_bytes(wave, wave->pos);
+	wave->pos += result;
+	return (int)result;
+}
+
+int wread(int16_t* buf, int framenum, WAVE* wave) {
+	const uint8_t* data;
+	int result = wview_raw(wave, framenum, (uint8_t*)buf, &data);
+	if ((data != NULL) && (data != (const uint8_t*)buf)) {
+		memcpy(buf, data, frame_offset_bytes(wave, result));
+	}
+	return result;
+}
+
+/* Read framenum frames converted to float. Integer samples are scaled by
+   2^-(bits-1) like the Opus API does (1/32768 for 16 bit), see opus_sm_pcm.h. */
+int wread_float(float* buf, int framenum, WAVE* wave) {
+	if (wave == NULL) return 0;
+	size_t bytes = (size_t)framenum * wave->header.BlockAlign;
+	if ((wave->map == NULL) && (wave->scratch_size < bytes)) {
+		free(wave->scratch);
+		wave->scratch = (uint8_t*)malloc(bytes);
+		wave->scratch_size = bytes;
+	}
+	const uint8_t* data;
+	int result = wview_raw(wave, framenum, wave->scratch, &data);
+	int count = result * wave->header.NumChannels;
+	int ii;
+	switch (wave->header.BitsPerSample + (wave->format == WAVE_FORMAT_IEEE_FLOAT ? 1000 : 0)) {
+	case 8:
+		for (ii = 0; ii < count; ++ii) {
+			buf[ii] = (float)((int)data[ii] - 128) * (1.f/128);
+		}
+		break;
+	case 16:
+		if (host_is_little_endian()) {
+			pcm_to_float(buf, data, PCM_S16, count);
+		} else {
+			for (ii = 0; ii < count; ++ii) {
+				buf[ii] = (float)(int16_t)get_u16(data + 2*ii) * (1.f/32768);
+			}
+		}
+		break;
+	case 24:
+		pcm_to_float(buf, data, PCM_S24, count);
+		break;
+	case 32:
+		for (ii = 0; ii < count; ++ii) {
+			buf[ii] = (float)((double)(int32_t)get_u32(data + 4*ii) * (1./2147483648.));
+		}
+		break;
+	case 1032:
+		if (host_is_little_endian()) {
+			pcm_to_float(buf, data, PCM_F32, count);
+		} else {
+			for (ii = 0; ii < count; ++ii) {
+				uint32_t v = get_u32(data + 4*ii);
+				memcpy(&buf[ii], &v, sizeof(float));
+			}
+		}
+		break;
+	case 1064:
+		for (ii = 0; ii < count; ++ii) {
+			uint64_t v = get_u64(data + 8*ii);
+			double d;
+			memcpy(&d, &v, sizeof(double));
+			buf[ii] = (float)d;
+		}
+		break;
+	default:
+		return 0;
+	}
+	return result;
+}
+
+/* Non-zero if the samples are 16 bit PCM, the only format wview() can return. */
+int wis_pcm16(WAVE* wave) {
+	return (wave != NULL) && (wave->format == WAVE_FORMAT_PCM) && (wave->header.BitsPerSample == 16);
+}
+
+/* Map the file into memory, so that wview() can return pointers into the data
+   chunk without copying. Only regular files are mapped, on pipes and other
+   streams (or without mmap support) the reader stays in streaming mode and
+   WAVE_ERR_MAP is returned, which is not fatal. */
+int wmap(WAVE* wave) {
+	if (wave == NULL) return WAVE_ERR_NULL_HANDLER;
+	if (wave->mode != 'r') return WAVE_ERR_READ_MODE_EXPECTED;
+	if (wave->header_init_done != 1) return WAVE_ERR_HEADER_NOT_INITIALIZED;
+	if (wave->map != NULL) return WAVE_OK;
+	if (wave->size == WAVE_SIZE_UNKNOWN) return WAVE_ERR_MAP;
+#ifdef HAVE_SYS_MMAN_H
+	struct stat st;
+	int fd = fileno(wave->fp);
+	if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)) {
+		return WAVE_ERR_MAP;
+	}
+	size_t data_end = (size_t)wave->data_offset + frame_offset_bytes(wave, wave->size);
+	if ((size_t)st.st_size < data_end) {
+		return WAVE_ERR_MAP;
+	}
+	void* map = mmap(NULL, data_end, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		return WAVE_ERR_MAP;
+	}
+#ifdef MADV_SEQUENTIAL
+	madvise(map, data_end, MADV_SEQUENTIAL);
+#endif
+	/* Continue from the current stream position */
+	long pos = ftell(wave->fp) - wave->data_offset;
+	wave->pos = (pos > 0) ? (int64_t)(pos / (long)frame_offset_bytes(wave, 1)) : 0;
+	wave->map = (const uint8_t*)map;
+	wave->map_size = data_end;
+	return WAVE_OK;
+#else
+	return WAVE_ERR_MAP;
+#endif
+}
+
+/* Read framenum 16 bit frames without copying when the file is mapped: *data
+   points into the mapping. When streaming, the frames are read into buf (which
+   must hold framenum frames) and *data points to buf. Return the number of
+   frames. Only for 16 bit PCM files, see wread_float() for the others. */
+int wview(WAVE* wave, int framenum, int16_t* buf, const int16_t** data) {
+	*data = NULL;
+	if (!wis_pcm16(wave)) {
+		if (wave != NULL) wave->error = WAVE_ERR_UNSUPPORTED_FORMAT;
+		return 0;
+	}
+	const uint8_t* raw;
+	int result = wview_raw(wave, framenum, (uint8_t*)buf, &raw);
+	*data = (const int16_t*)raw;
 	return result;
 }
 
+/* Position the read pointer at the given sample frame of the data chunk. */
+int wseek(WAVE* wave, int64_t framepos) {
+	if (wave == NULL) return WAVE_ERR_NULL_HANDLER;
+	if (wave->error == WAVE_ERR_HEADER_ALREADY_INITIALIZED) wave->error = WAVE_OK;
+	if (wave->mode != 'r') wave->error = WAVE_ERR_READ_MODE_EXPECTED;
+	if (wave->header_init_done != 1) wave->error = WAVE_ERR_HEADER_NOT_INITIALIZED;
+	if (wave->error != WAVE_OK) return wave->error;
+	if ((framepos < 0) || ((wave->size != WAVE_SIZE_UNKNOWN) && (framepos > wave->size))) {
+		wave->error = WAVE_ERR_READ;
+		return wave->error;
+	}
+	if (wave->map != NULL) {
+		wave->pos = framepos;
+		return wave->error;
+	}
+	long pos = wave->data_offset + (long)frame_offset_bytes(wave, framepos);
+	if (fseek(wave->fp, pos, SEEK_SET) != 0) {
+		wave->error = WAVE_ERR_READ;
+	} else {
+		wave->pos = framepos;
+	}
+	return wave->error;
+}
+
 int wsetheader(WAVE* wave) {
 	if (wave == NULL) return WAVE_ERR_NULL_HANDLER;
 	if (wave->error == WAVE_ERR_HEADER_NOT_INITIALIZED) wave->error = WAVE_OK;
@@ -1,10 +1,18 @@
 /*
  * Simple WAV file read and write library.
- * It supports only 16bit PCM WAVE files.
- *   (TODO: specify details: endianness, etc.)
+ * Reading walks the RIFF chunks, so metadata chunks (LIST, bext, fact, ...)
+ * are skipped. Supported sample formats: 8, 16, 24 and 32 bit integer PCM,
+ * 32 and 64 bit float, also in WAVE_FORMAT_EXTENSIBLE files. RF64 (BW64)
+ * files are read with their 64 bit sizes. Writing supports only 16bit PCM.
+ * Regular files can be read through a memory mapping (wmap(), wview()).
+ * The file name "-" is stdin (or stdout), and headerless PCM can be described
+ * with wrawheader(). Streams written with an unknown length (data size 0 on a
+ * pipe, or 0xFFFFFFFF) get WAVE_SIZE_UNKNOWN and are read up to the end.
+ * Samples are little endian, the host is expected to be little endian too.
  *
  * Wave format information is from:
  *    https://ccrma.stanford.edu/courses/422/projects/WaveFormat/
+ *    EBU Tech 3306 (RF64)
  */
 
 #ifndef _WAV_H_
@@ -22,16 +30,24 @@
 #define WAVE_ERR_HEADER_NOT_INITIALIZED     5
 #define WAVE_ERR_READ                       6
 #define WAVE_ERR_WRITE                      7
+#define WAVE_ERR_MAP                        8
+#define WAVE_ERR_UNSUPPORTED_FORMAT         9
+
+#define WAVE_SIZE_UNKNOWN                   (-1)
+
+#define WAVE_FORMAT_PCM                     0x0001
+#define WAVE_FORMAT_IEEE_FLOAT              0x0003
+#define WAVE_FORMAT_EXTENSIBLE              0xFFFE
 
 typedef struct WAVEHeader {
-	uint8_t     ChunkID[4];  // "RIFF"
+	uint8_t     ChunkID[4];  // "RIFF" (or "RF64", "BW64" when reading)
 	uint32_t    ChunkSize;   // size, complicated to calculate
 	uint8_t     Format[4];   // "WAVE"
 
 	// Subchunk "fmt "
 	uint8_t    Subchunk1ID[4]; // "fmt "
 	uint32_t   Subchunk1Size;  // PCM -> 16
-	uint16_t   AudioFormat;    // PCM -> 1
+	uint16_t   AudioFormat;    // PCM -> 1, float -> 3, extensible -> 0xFFFE
 	uint16_t   NumChannels;    // Mono -> 1, Stereo -> 2, etc.
 	uint32_t   SampleRate;     // 8000, 44100, 48000, etc.
 	uint32_t   ByteRate;       // SampleRate * NumChannels * BitsPerSample/8
@@ -40,7 +56,7 @@ typedef struct WAVEHeader {
 
 	// Subchunk "data"
 	uint8_t    Subchunk2ID[4]; // "data"
-	uint32_t   Subchunk2Size;  // NumSamples * NumChannels * BitsPerSample/8
+	uint32_t   Subchunk2Size;  // NumSamples * NumChannels * BitsPerSample/8, 0xFFFFFFFF in RF64
 } WAVEHeader;
 
 
@@ -51,14 +67,28 @@ typedef struct WAVE {
 	WAVEHeader   header;
 	int          header_init_done;
 	char         mode;
-	int          size; // NumSamples
+	int64_t      size; // NumSamples, WAVE_SIZE_UNKNOWN if the data runs up to the end of the stream
     int          error;
+    int          format;      // WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT (resolved from extensible)
+    uint64_t     data_size;   // size of the data chunk in bytes (64 bit in RF64)
+    long         data_offset; // file position of the first sample
     FILE*        fp;
+    const uint8_t* map;       // read-only mapping of the file, NULL when streaming
+    size_t       map_size;
+    int64_t      pos;         // next frame to read
+    uint8_t*     scratch;     // raw frames of wread_float() when streaming
+    size_t       scratch_size;
 } WAVE;
 
 WAVE* wopen(const char* fname, const char* mode);
 int   wgetheader(WAVE* wave);
+int   wrawheader(WAVE* wave, uint32_t samplerate, uint16_t channels, uint16_t bits, int format);
 int   wread(int16_t* buf, int framenum, WAVE* wave);
+int   wread_float(float* buf, int framenum, WAVE* wave);
+int   wseek(WAVE* wave, int64_t framepos);
+int   wmap(WAVE* wave);
+int   wview(WAVE* wave, int framenum, int16_t* buf, const int16_t** data);
+int   wis_pcm16(WAVE* wave);
 int   wsetheader(WAVE* wave);
 int   wwrite(int16_t* buf, int framenum, WAVE* wave);
 int   frame_size_bytes(WAVE* wave, int frame_num);
@@ -48,27 +48,60 @@
 #define M_PI 3.141592653
 #endif
 
+#ifdef ANALYSIS_PROFILE
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define analysis_ticks() ((opus_uint64)__rdtsc())
+#else
+#include <time.h>
+static opus_uint64 analysis_ticks(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (opus_uint64)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+#endif
+/* A stage may be timed in several parts with ANALYSIS_PROFILE_PAUSE(), the
+   last one ends with ANALYSIS_PROFILE_END(), which counts a call. */
+#define ANALYSIS_PROFILE_BEGIN(tonal, stage) ((tonal)->profile.start[stage] = analysis_ticks())
+#define ANALYSIS_PROFILE_PAUSE(tonal, stage) \
+   ((tonal)->profile.ticks[stage] += analysis_ticks() - (tonal)->profile.start[stage])
+#define ANALYSIS_PROFILE_END(tonal, stage) \
+   (ANALYSIS_PROFILE_PAUSE(tonal, stage), (tonal)->profile.calls[stage]++)
+#else
+#define ANALYSIS_PROFILE_BEGIN(tonal, stage)
+#define ANALYSIS_PROFILE_PAUSE(tonal, stage)
+#define ANALYSIS_PROFILE_END(tonal, stage)
+#endif
+
 #ifndef DISABLE_FLOAT_API
 
 #define TRANSITION_PENALTY 10
 
+/* DCT-II of the 16 first bands, transposed: dct_table[b*8 + i] is the
+   weight of band b in coefficient i, so the BFCCs are computed band by band
+   with the 8 coefficients side by side. */
 static const float dct_table[128] = {
-        0.250000f, 0.250000f, 0.250000f, 0.250000f, 0.250000f, 0.250000f, 0.250000f, 0.250000f,
-        0.250000f, 0.250000f, 0.250000f, 0.250000f, 0.250000f, 0.250000f, 0.250000f, 0.250000f,
-        0.351851f, 0.338330f, 0.311806f, 0.273300f, 0.224292f, 0.166664f, 0.102631f, 0.034654f,
-       -0.034654f,-0.102631f,-0.166664f,-0.224292f,-0.273300f,-0.311806f,-0.338330f,-0.351851f,
-        0.346760f, 0.293969f, 0.196424f, 0.068975f,-0.068975f,-0.196424f,-0.293969f,-0.346760f,
-       -0.346760f,-0.293969f,-0.196424f,-0.068975f, 0.068975f, 0.196424f, 0.293969f, 0.346760f,
-        0.338330f, 0.224292f, 0.034654f,-0.166664f,-0.311806f,-0.351851f,-0.273300f,-0.102631f,
-        0.102631f, 0.273300f, 0.351851f, 0.311806f, 0.166664f,-0.034654f,-0.224292f,-0.338330f,
-        0.326641f, 0.135299f,-0.135299f,-0.326641f,-0.326641f,-0.135299f, 0.135299f, 0.326641f,
-        0.326641f, 0.135299f,-0.135299f,-0.326641f,-0.326641f,-0.135299f, 0.135299f, 0.326641f,
-        0.311806f, 0.034654f,-0.273300f,-0.338330f,-0.102631f, 0.224292f, 0.351851f, 0.166664f,
-       -0.166664f,-0.351851f,-0.224292f, 0.102631f, 0.338330f, 0.273300f,-0.034654f,-0.311806f,
-        0.293969f,-0.068975f,-0.346760f,-0.196424f, 0.196424f, 0.346760f, 0.068975f,-0.293969f,
-       -0.293969f, 0.068975f, 0.346760f, 0.196424f,-0.196424f,-0.346760f,-0.068975f, 0.293969f,
-        0.273300f,-0.166664f,-0.338330f, 0.034654f, 0.351851f, 0.102631f,-0.311806f,-0.224292f,
-        0.224292f, 0.311806f,-0.102631f,-0.351851f,-0.034654f, 0.338330f, 0.166664f,-0.273300f,
+        0.250000f, 0.351851f, 0.346760f, 0.338330f, 0.326641f, 0.311806f, 0.293969f, 0.273300f,
+        0.250000f, 0.338330f, 0.293969f, 0.224292f, 0.135299f, 0.034654f,-0.068975f,-0.166664f,
+        0.250000f, 0.311806f, 0.196424f, 0.034654f,-0.135299f,-0.273300f,-0.346760f,-0.338330f,
+        0.250000f, 0.273300f, 0.068975f,-0.166664f,-0.326641f,-0.338330f,-0.196424f, 0.034654f,
+        0.250000f, 0.224292f,-0.068975f,-0.311806f,-0.326641f,-0.102631f, 0.196424f, 0.351851f,
+        0.250000f, 0.166664f,-0.196424f,-0.351851f,-0.135299f, 0.224292f, 0.346760f, 0.102631f,
+        0.250000f, 0.102631f,-0.293969f,-0.273300f, 0.135299f, 0.351851f, 0.068975f,-0.311806f,
+        0.250000f, 0.034654f,-0.346760f,-0.102631f, 0.326641f, 0.166664f,-0.293969f,-0.224292f,
+        0.250000f,-0.034654f,-0.346760f, 0.102631f, 0.326641f,-0.166664f,-0.293969f, 0.224292f,
+        0.250000f,-0.102631f,-0.293969f, 0.273300f, 0.135299f,-0.351851f, 0.068975f, 0.311806f,
+        0.250000f,-0.166664f,-0.196424f, 0.351851f,-0.135299f,-0.224292f, 0.346760f,-0.102631f,
+        0.250000f,-0.224292f,-0.068975f, 0.311806f,-0.326641f, 0.102631f, 0.196424f,-0.351851f,
+        0.250000f,-0.273300f, 0.068975f, 0.166664f,-0.326641f, 0.338330f,-0.196424f,-0.034654f,
+        0.250000f,-0.311806f, 0.196424f,-0.034654f,-0.135299f, 0.273300f,-0.346760f, 0.338330f,
+        0.250000f,-0.338330f, 0.293969f,-0.224292f, 0.135299f,-0.034654f,-0.068975f, 0.166664f,
+        0.250000f,-0.351851f, 0.346760f,-0.338330f, 0.326641f,-0.311806f, 0.293969f,-0.273300f,
 };
 
 static const float analysis_window[240] = {
@@ -110,46 +143,69 @@ static const int tbands[NB_TBANDS+1] = {
 
 #define NB_TONAL_SKIP_BANDS 9
 
+/* One output sample of silk_resampler_down2_hp() from the input samples in0
+   and in1, the high band energy is added to hp_ener (if not NULL) */
+static OPUS_INLINE opus_val32 resampler_down2_hp_step(
+    opus_val32                  *S,                 /* I/O  State vector [ 3 ]                                          */
+    opus_val32                  in0,                /* I    Even input sample                                           */
+    opus_val32                  in1,                /* I    Odd input sample                                            */
+    opus_val64                  *hp_ener            /* I/O  High band energy                                            */
+)
+{
+    opus_val32 in32, out32, out32_hp, Y, X;
+    /* Convert to Q10 */
+    in32 = in0;
+
+    /* All-pass section for even input sample */
+    Y      = SUB32( in32, S[ 0 ] );
+    X      = MULT16_32_Q15(QCONST16(0.6074371f, 15), Y);
+    out32  = ADD32( S[ 0 ], X );
+    S[ 0 ] = ADD32( in32, X );
+    out32_hp = out32;
+    /* Convert to Q10 */
+    in32 = in1;
+
+    /* All-pass section for odd input sample, and add to output of previous section */
+    Y      = SUB32( in32, S[ 1 ] );
+    X      = MULT16_32_Q15(QCONST16(0.15063f, 15), Y);
+    out32  = ADD32( out32, S[ 1 ] );
+    out32  = ADD32( out32, X );
+    S[ 1 ] = ADD32( in32, X );
+
+    if (hp_ener != NULL)
+    {
+       Y      = SUB32( -in32, S[ 2 ] );
+       X      = MULT16_32_Q15(QCONST16(0.15063f, 15), Y);
+       out32_hp  = ADD32( out32_hp, S[ 2 ] );
+       out32_hp  = ADD32( out32_hp, X );
+       S[ 2 ] = ADD32( -in32, X );
+
+       *hp_ener += out32_hp*(opus_val64)out32_hp;
+    }
+    /* Add, convert back to int16 and store to output */
+    return HALF32(out32);
+}
+
 static opus_val32 silk_resampler_down2_hp(
     opus_val32                  *S,                 /* I/O  State vector [ 2 ]                                          */
     opus_val32                  *out,               /* O    Output signal [ floor(len/2) ]                              */
     const opus_val32            *in,                /* I    Input signal [ len ]                                        */
-    int                         inLen               /* I    Number of input samples                                     */
+    int                         inLen,              /* I    Number of input samples                                     */
+    int                         hp                  /* I    Compute the high band energy                                */
 )
 {
     int k, len2 = inLen/2;
-    opus_val32 in32, out32, out32_hp, Y, X;
     opus_val64 hp_ener = 0;
     /* Internal variables and state are in Q10 format */
-    for( k = 0; k < len2; k++ ) {
-        /* Convert to Q10 */
-        in32 = in[ 2 * k ];
-
-        /* All-pass section for even input sample */
-        Y      = SUB32( in32, S[ 0 ] );
-        X      = MULT16_32_Q15(QCONST16(0.6074371f, 15), Y);
-        out32  = ADD32( S[ 0 ], X );
-        S[ 0 ] = ADD32( in32, X );
-        out32_hp = out32;
-        /* Convert to Q10 */
-        in32 = in[ 2 * k + 1 ];
-
-        /* All-pass section for odd input sample, and add to output of previous section */
-        Y      = SUB32( in32, S[ 1 ] );
-        X      = MULT16_32_Q15(QCONST16(0.15063f, 15), Y);
-        out32  = ADD32( out32, S[ 1 ] );
-        out32  = ADD32( out32, X );
-        S[ 1 ] = ADD32( in32, X );
-
-        Y      = SUB32( -in32, S[ 2 ] );
-        X      = MULT16_32_Q15(QCONST16(0.15063f, 15), Y);
-        out32_hp  = ADD32( out32_hp, S[ 2 ] );
-        out32_hp  = ADD32( out32_hp, X );
-        S[ 2 ] = ADD32( -in32, X );
-
-        hp_ener += out32_hp*(opus_val64)out32_hp;
-        /* Add, convert back to int16 and store to output */
-        out[ k ] = HALF32(out32);
+    if (hp)
+    {
+       for( k = 0; k < len2; k++ ) {
+           out[ k ] = resampler_down2_hp_step( S, in[ 2 * k ], in[ 2 * k + 1 ], &hp_ener );
+       }
+    } else {
+       for( k = 0; k < len2; k++ ) {
+           out[ k ] = resampler_down2_hp_step( S, in[ 2 * k ], in[ 2 * k + 1 ], NULL );
+       }
     }
 #ifdef FIXED_POINT
     /* len2 can be up to 480, so we shift by 8 more to make it fit. */
@@ -158,7 +214,49 @@ static opus_val32 silk_resampler_down2_hp(
     return (opus_val32)hp_ener;
 }
 
-static opus_val32 downmix_and_resample(downmix_func downmix, const void *_x, opus_val32 *y, opus_val32 S[3], int subframe, int offset, int c1, int c2, int C, int Fs)
+#ifndef FIXED_POINT
+/* downmix_and_resample() of 48 kHz input for downmix_float() and downmix_int()
+   when at most two channels are mixed (c2 == -2 with C <= 2, or c1 alone or
+   with c2): the samples are mixed, scaled and decimated in one pass, without
+   the callback and the temporary buffer. The operations are the same, and so
+   are the results. There is one loop for each format and channel count. */
+static opus_val32 downmix_and_resample_48k(const void *_x, opus_val32 *y, opus_val32 S[3], int subframe, int offset,
+      int c1, int c2, int C, opus_val32 scale, int int16, int hp)
+{
+   int k, len2 = subframe/2;
+   opus_val64 hp_ener = 0;
+   opus_val64 *hp_ener_ptr = hp ? &hp_ener : NULL;
+   if (c2 == -2)
+      c2 = C == 2 ? 1 : -1;
+   if (int16)
+   {
+      const opus_int16 *x = (const opus_int16 *)_x + offset*C;
+      if (c2 < 0)
+      {
+         for (k=0;k<len2;k++)
+            y[k] = resampler_down2_hp_step(S, x[2*k*C+c1]*scale, x[(2*k+1)*C+c1]*scale, hp_ener_ptr);
+      } else {
+         for (k=0;k<len2;k++)
+            y[k] = resampler_down2_hp_step(S, ((opus_val32)x[2*k*C+c1] + x[2*k*C+c2])*scale,
+                  ((opus_val32)x[(2*k+1)*C+c1] + x[(2*k+1)*C+c2])*scale, hp_ener_ptr);
+      }
+   } else {
+      const float *x = (const float *)_x + offset*C;
+      if (c2 < 0)
+      {
+         for (k=0;k<len2;k++)
+            y[k] = resampler_down2_hp_step(S, SCALEIN(x[2*k*C+c1])*scale, SCALEIN(x[(2*k+1)*C+c1])*scale, hp_ener_ptr);
+      } else {
+         for (k=0;k<len2;k++)
+            y[k] = resampler_down2_hp_step(S, (SCALEIN(x[2*k*C+c1]) + SCALEIN(x[2*k*C+c2]))*scale,
+                  (SCALEIN(x[(2*k+1)*C+c1]) + SCALEIN(x[(2*k+1)*C+c2]))*scale, hp_ener_ptr);
+      }
+   }
+   return (opus_val32)hp_ener;
+}
+#endif
+
+static opus_val32 downmix_and_resample(downmix_func downmix, const void *_x, opus_val32 *y, opus_val32 S[3], int subframe, int offset, int c1, int c2, int C, int Fs, int hp)
 {
    VARDECL(opus_val32, tmp);
    opus_val32 scale;
@@ -175,9 +273,6 @@ static opus_val32 downmix_and_resample(downmix_func downmix, const void *_x, opu
       subframe = subframe*2/3;
       offset = offset*2/3;
    }
-   ALLOC(tmp, subframe, opus_val32);
-
-   downmix(_x, tmp, subframe, offset, c1, c2, C);
 #ifdef FIXED_POINT
    scale = (1<<SIG_SHIFT);
 #else
@@ -187,11 +282,22 @@ static opus_val32 downmix_and_resample(downmix_func downmix, const void *_x, opu
       scale /= C;
    else if (c2>-1)
       scale /= 2;
+#ifndef FIXED_POINT
+   if (Fs == 48000 && (downmix == downmix_float || downmix == downmix_int) && (c2 != -2 || C <= 2))
+   {
+      ret = downmix_and_resample_48k(_x, y, S, subframe, offset, c1, c2, C, scale, downmix == downmix_int, hp);
+      RESTORE_STACK;
+      return ret;
+   }
+#endif
+   ALLOC(tmp, subframe, opus_val32);
+
+   downmix(_x, tmp, subframe, offset, c1, c2, C);
    for (j=0;j<subframe;j++)
       tmp[j] *= scale;
    if (Fs == 48000)
    {
-      ret = silk_resampler_down2_hp(S, y, tmp, subframe);
+      ret = silk_resampler_down2_hp(S, y, tmp, subframe, hp);
    } else if (Fs == 24000) {
       OPUS_COPY(y, tmp, subframe);
    } else if (Fs == 16000) {
@@ -206,17 +312,30 @@ static opus_val32 downmix_and_resample(downmix_func downmix, const void *_x, opu
          tmp3x[3*j+1] = tmp[j];
          tmp3x[3*j+2] = tmp[j];
       }
-      silk_resampler_down2_hp(S, y, tmp3x, 3*subframe);
+      silk_resampler_down2_hp(S, y, tmp3x, 3*subframe, 0);
    }
    RESTORE_STACK;
    return ret;
 }
 
+const CELTMode *tonality_analysis_mode(void)
+{
+   /* The 480 point FFT of the 20 ms frames is the first one of the 48 kHz mode */
+   return celt_static_mode(48000, 960);
+}
+
 void tonality_analysis_init(TonalityAnalysisState *tonal, opus_int32 Fs)
 {
   /* Initialize reusable fields. */
   tonal->arch = opus_select_arch();
   tonal->Fs = Fs;
+  tonal->mlp_features = NULL;
+  tonal->decimation = 1;
+  tonal->outputs = ANALYSIS_ALL;
+  tonal->model = &mlp_default_model;
+#ifdef ANALYSIS_PROFILE
+  OPUS_CLEAR(&tonal->profile, 1);
+#endif
   /* Clear remaining fields. */
   tonality_analysis_reset(tonal);
 }
@@ -228,6 +347,18 @@ void tonality_analysis_reset(TonalityAnalysisState *tonal)
   OPUS_CLEAR(start, sizeof(TonalityAnalysisState) - (start - (char*)tonal));
 }
 
+int tonality_analysis_profile(const TonalityAnalysisState *tonal, AnalysisProfile *profile)
+{
+#ifdef ANALYSIS_PROFILE
+  OPUS_COPY(profile, &tonal->profile, 1);
+  return 1;
+#else
+  (void)tonal;
+  OPUS_CLEAR(profile, 1);
+  return 0;
+#endif
+}
+
 void tonality_get_info(TonalityAnalysisState *tonal, AnalysisInfo *info_out, int len)
 {
    int pos;
@@ -244,6 +375,7 @@ void tonality_get_info(TonalityAnalysisState *tonal, AnalysisInfo *info_out, int
    int mpos, vpos;
    int bandwidth_span;
 
+   ANALYSIS_PROFILE_BEGIN(tonal, ANALYSIS_STAGE_GET_INFO);
    pos = tonal->read_pos;
    curr_lookahead = tonal->write_pos-tonal->read_pos;
    if (curr_lookahead<0)
@@ -401,6 +533,7 @@ void tonality_get_info(TonalityAnalysisState *tonal, AnalysisInfo *info_out, int
    }
    if (tonal->read_pos>=DETECT_SIZE)
       tonal->read_pos-=DETECT_SIZE;
+   ANALYSIS_PROFILE_END(tonal, ANALYSIS_STAGE_GET_INFO);
 }
 
 static const float std_feature_bias[9] = {
@@ -420,116 +553,21 @@ static const float std_feature_bias[9] = {
 #define SCALE_ENER(e) (e)
 #endif
 
-static void tonality_analysis(TonalityAnalysisState *tonal, const CELTMode *celt_mode, const void *x, int len, int offset, int c1, int c2, int C, int lsb_depth, downmix_func downmix)
-{
-    int i, b;
-    const kiss_fft_state *kfft;
-    VARDECL(kiss_fft_cpx, in);
-    VARDECL(kiss_fft_cpx, out);
-    int N = 480, N2=240;
-    float * OPUS_RESTRICT A = tonal->angle;
-    float * OPUS_RESTRICT dA = tonal->d_angle;
-    float * OPUS_RESTRICT d2A = tonal->d2_angle;
-    VARDECL(float, tonality);
-    VARDECL(float, noisiness);
-    float band_tonality[NB_TBANDS];
-    float logE[NB_TBANDS];
-    float BFCC[8];
-    float features[25];
-    float frame_tonality;
-    float max_frame_tonality;
-    /*float tw_sum=0;*/
-    float frame_noisiness;
-    const float pi4 = (float)(M_PI*M_PI*M_PI*M_PI);
-    float slope=0;
-    float frame_stationarity;
-    float relativeE;
-    float frame_probs[2];
-    float alpha, alphaE, alphaE2;
-    float frame_loudness;
-    float bandwidth_mask;
-    int is_masked[NB_TBANDS+1];
-    int bandwidth=0;
-    float maxE = 0;
-    float noise_floor;
-    int remaining;
-    AnalysisInfo *info;
-    float hp_ener;
-    float tonality2[240];
-    float midE[8];
-    float spec_variability=0;
-    float band_log2[NB_TBANDS+1];
-    float leakage_from[NB_TBANDS+1];
-    float leakage_to[NB_TBANDS+1];
-    float layer_out[MAX_NEURONS];
-    float below_max_pitch;
-    float above_max_pitch;
-    SAVE_STACK;
-
-    alpha = 1.f/IMIN(10, 1+tonal->count);
-    alphaE = 1.f/IMIN(25, 1+tonal->count);
-    /* Noise floor related decay for bandwidth detection: -2.2 dB/second */
-    alphaE2 = 1.f/IMIN(100, 1+tonal->count);
-    if (tonal->count <= 1) alphaE2 = 1;
-
-    if (tonal->Fs == 48000)
-    {
-       /* len and offset are now at 24 kHz. */
-       len/= 2;
-       offset /= 2;
-    } else if (tonal->Fs == 16000) {
-       len = 3*len/2;
-       offset = 3*offset/2;
-    }
-
-    kfft = celt_mode->mdct.kfft[0];
-    if (tonal->count==0)
-       tonal->mem_fill = 240;
-    tonal->hp_ener_accum += (float)downmix_and_resample(downmix, x,
-          &tonal->inmem[tonal->mem_fill], tonal->downmix_state,
-          IMIN(len, ANALYSIS_BUF_SIZE-tonal->mem_fill), offset, c1, c2, C, tonal->Fs);
-    if (tonal->mem_fill+len < ANALYSIS_BUF_SIZE)
-    {
-       tonal->mem_fill += len;
-       /* Don't have enough to update the analysis */
-       RESTORE_STACK;
-       return;
-    }
-    hp_ener = tonal->hp_ener_accum;
-    info = &tonal->info[tonal->write_pos++];
-    if (tonal->write_pos>=DETECT_SIZE)
-       tonal->write_pos-=DETECT_SIZE;
-
-    ALLOC(in, 480, kiss_fft_cpx);
-    ALLOC(out, 480, kiss_fft_cpx);
-    ALLOC(tonality, 240, float);
-    ALLOC(noisiness, 240, float);
-    for (i=0;i<N2;i++)
-    {
-       float w = analysis_window[i];
-       in[i].r = (kiss_fft_scalar)(w*tonal->inmem[i]);
-       in[i].i = (kiss_fft_scalar)(w*tonal->inmem[N2+i]);
-       in[N-i-1].r = (kiss_fft_scalar)(w*tonal->inmem[N-i-1]);
-       in[N-i-1].i = (kiss_fft_scalar)(w*tonal->inmem[N+N2-i-1]);
-    }
-    OPUS_MOVE(tonal->inmem, tonal->inmem+ANALYSIS_BUF_SIZE-240, 240);
-    remaining = len - (ANALYSIS_BUF_SIZE-tonal->mem_fill);
-    tonal->hp_ener_accum = (float)downmix_and_resample(downmix, x,
-          &tonal->inmem[240], tonal->downmix_state, remaining,
-          offset+ANALYSIS_BUF_SIZE-tonal->mem_fill, c1, c2, C, tonal->Fs);
-    tonal->mem_fill = 240 + remaining;
-    opus_fft(kfft, in, out, tonal->arch);
-#ifndef FIXED_POINT
-    /* If there's any NaN on the input, the entire output will be NaN, so we only need to check one value. */
-    if (celt_isnan(out[0].r))
-    {
-       info->valid = 0;
-       RESTORE_STACK;
-       return;
-    }
+#if defined(FLOAT_APPROX) && !defined(FIXED_POINT)
+/* Natural log of the band energies, from the celt_log2() approximation */
+#define ANALYSIS_LOG(x) (0.6931472f*celt_log2(x))
+#else
+#define ANALYSIS_LOG(x) ((float)log(x))
 #endif
 
-    for (i=1;i<N2;i++)
+void tonality_bins_c(const kiss_fft_cpx *out, int N, int start, float *A, float *dA, float *d2A,
+      float *tonality, float *tonality2, float *noisiness)
+{
+    int i;
+    int N2;
+    const float pi4 = (float)(M_PI*M_PI*M_PI*M_PI);
+    N2 = N/2;
+    for (i=start;i<N2;i++)
     {
        float X1r, X2r, X1i, X2i;
        float angle, d_angle, d2_angle;
@@ -568,11 +606,105 @@ static void tonality_analysis(TonalityAnalysisState *tonal, const CELTMode *celt
        dA[i] = d_angle2;
        d2A[i] = mod2;
     }
-    for (i=2;i<N2-1;i++)
+}
+
+/* In fast mode, the windows skipped before an invalid one (info) cannot be
+   interpolated anymore: they become invalid too, instead of keeping the copy
+   of the previous result they got while waiting. */
+static void drop_skipped(TonalityAnalysisState *tonal, AnalysisInfo *info)
+{
+    int j;
+    for (j=0;j<tonal->skipped;j++)
+       tonal->info[(info - tonal->info + DETECT_SIZE - tonal->skipped + j) % DETECT_SIZE].valid = 0;
+    tonal->skipped = 0;
+}
+
+/* MLP of the window of info, now or later (see tonality_analysis_mlp()) */
+static void analysis_mlp(TonalityAnalysisState *tonal, AnalysisInfo *info, const float *features)
+{
+    float layer_out[MAX_NEURONS];
+    float frame_probs[2];
+#ifdef ANALYSIS_INT16_FEATURES
+    int i;
+    opus_int16 qfeatures[25];
+    float dqfeatures[25];
+    for (i=0;i<25;i++)
     {
-       float tt = MIN32(tonality2[i], MAX32(tonality2[i-1], tonality2[i+1]));
-       tonality[i] = .9f*MAX32(tonality[i], tt-.1f);
+       qfeatures[i] = (opus_int16)IMAX(-32767, IMIN(32767, float2int(features[i]*(1<<MLP_INPUT_SHIFT))));
+       dqfeatures[i] = qfeatures[i]*(1.f/(1<<MLP_INPUT_SHIFT));
     }
+    /* The batched MLP gets the same values in float */
+    features = dqfeatures;
+#endif
+    ANALYSIS_PROFILE_BEGIN(tonal, ANALYSIS_STAGE_MLP);
+    if (tonal->mlp_features != NULL)
+    {
+       /* Evaluated later with the other analyses of the batch */
+       OPUS_COPY(&tonal->mlp_features[(info - tonal->info)*MAX_NEURONS], features, 25);
+    } else {
+#ifdef ANALYSIS_INT16_FEATURES
+       compute_dense_int16(tonal->model->layer0, layer_out, qfeatures);
+#else
+       compute_dense(tonal->model->layer0, layer_out, features, tonal->arch);
+#endif
+       compute_gru(tonal->model->layer1, tonal->rnn_state, layer_out, tonal->arch);
+       compute_dense(tonal->model->layer2, frame_probs, tonal->rnn_state, tonal->arch);
+
+       /* Probability of speech or music vs noise */
+       info->activity_probability = frame_probs[1];
+       info->music_prob = frame_probs[0];
+    }
+    ANALYSIS_PROFILE_END(tonal, ANALYSIS_STAGE_MLP);
+}
+
+/* Everything that follows the spectrum of a window: band energy tracking,
+   bandwidth, leakage and the MLP features. bandE[], band_tE[] and band_nE[]
+   are the energy of each band and its tonal and noisy parts. out is the
+   spectrum, only used for the bandwidth and the leakage (not in fast mode). */
+static void tonality_features(TonalityAnalysisState *tonal, AnalysisInfo *info, const kiss_fft_cpx *out,
+      const float *bandE, const float *band_tE, const float *band_nE, float hp_ener, int lsb_depth)
+{
+    int i, b;
+    int N = 480;
+    float band_tonality[NB_TBANDS];
+    float logE[NB_TBANDS];
+    float BFCC[8];
+    float features[25];
+    float frame_tonality;
+    float max_frame_tonality;
+    /*float tw_sum=0;*/
+    float frame_noisiness;
+    float slope=0;
+    float frame_stationarity;
+    float relativeE;
+    float alpha, alphaE, alphaE2;
+    float frame_loudness;
+    float bandwidth_mask;
+    int is_masked[NB_TBANDS+1];
+    int bandwidth=0;
+    float maxE = 0;
+    float noise_floor;
+    float midE[8];
+    float spec_variability=0;
+    float band_log2[NB_TBANDS+1];
+    float leakage_from[NB_TBANDS+1];
+    float leakage_to[NB_TBANDS+1];
+    float below_max_pitch;
+    float above_max_pitch;
+    int outputs;
+
+    ANALYSIS_PROFILE_BEGIN(tonal, ANALYSIS_STAGE_FEATURES);
+    alpha = 1.f/IMIN(10, 1+tonal->count);
+    alphaE = 1.f/IMIN(25, 1+tonal->count);
+    /* Noise floor related decay for bandwidth detection: -2.2 dB/second */
+    alphaE2 = 1.f/IMIN(100, 1+tonal->count);
+    if (tonal->count <= 1) alphaE2 = 1;
+    /* Fast mode: the skipped windows have no spectrum for the bandwidth and
+       the leakage. */
+    outputs = tonal->outputs;
+    if (tonal->decimation > 1)
+       outputs &= ~(ANALYSIS_BANDWIDTH|ANALYSIS_LEAKAGE);
+
     frame_tonality = 0;
     max_frame_tonality = 0;
     /*tw_sum = 0;*/
@@ -589,52 +721,17 @@ static void tonality_analysis(TonalityAnalysisState *tonal, const CELTMode *celt
     }
     relativeE = 0;
     frame_loudness = 0;
-    /* The energy of the very first band is special because of DC. */
-    {
-       float E = 0;
-       float X1r, X2r;
-       X1r = 2*(float)out[0].r;
-       X2r = 2*(float)out[0].i;
-       E = X1r*X1r + X2r*X2r;
-       for (i=1;i<4;i++)
-       {
-          float binE = out[i].r*(float)out[i].r + out[N-i].r*(float)out[N-i].r
-                     + out[i].i*(float)out[i].i + out[N-i].i*(float)out[N-i].i;
-          E += binE;
-       }
-       E = SCALE_ENER(E);
-       band_log2[0] = .5f*1.442695f*(float)log(E+1e-10f);
-    }
     for (b=0;b<NB_TBANDS;b++)
     {
-       float E=0, tE=0, nE=0;
+       float E=bandE[b], tE=band_tE[b], nE=band_nE[b];
        float L1, L2;
        float stationarity;
-       for (i=tbands[b];i<tbands[b+1];i++)
-       {
-          float binE = out[i].r*(float)out[i].r + out[N-i].r*(float)out[N-i].r
-                     + out[i].i*(float)out[i].i + out[N-i].i*(float)out[N-i].i;
-          binE = SCALE_ENER(binE);
-          E += binE;
-          tE += binE*MAX32(0, tonality[i]);
-          nE += binE*2.f*(.5f-noisiness[i]);
-       }
-#ifndef FIXED_POINT
-       /* Check for extreme band energies that could cause NaNs later. */
-       if (!(E<1e9f) || celt_isnan(E))
-       {
-          info->valid = 0;
-          RESTORE_STACK;
-          return;
-       }
-#endif
 
        tonal->E[tonal->E_count][b] = E;
        frame_noisiness += nE/(1e-15f+E);
 
        frame_loudness += (float)sqrt(E+1e-10f);
-       logE[b] = (float)log(E+1e-10f);
-       band_log2[b+1] = .5f*1.442695f*(float)log(E+1e-10f);
+       logE[b] = ANALYSIS_LOG(E+1e-10f);
        tonal->logE[tonal->E_count][b] = logE[b];
        if (tonal->count==0)
           tonal->highE[b] = tonal->lowE[b] = logE[b];
@@ -686,34 +783,57 @@ static void tonality_analysis(TonalityAnalysisState *tonal, const CELTMode *celt
        tonal->prev_band_tonality[b] = band_tonality[b];
     }
 
-    leakage_from[0] = band_log2[0];
-    leakage_to[0] = band_log2[0] - LEAKAGE_OFFSET;
-    for (b=1;b<NB_TBANDS+1;b++)
+    if (outputs & ANALYSIS_LEAKAGE)
     {
-       float leak_slope = LEAKAGE_SLOPE*(tbands[b]-tbands[b-1])/4;
-       leakage_from[b] = MIN16(leakage_from[b-1]+leak_slope, band_log2[b]);
-       leakage_to[b] = MAX16(leakage_to[b-1]-leak_slope, band_log2[b]-LEAKAGE_OFFSET);
-    }
-    for (b=NB_TBANDS-2;b>=0;b--)
-    {
-       float leak_slope = LEAKAGE_SLOPE*(tbands[b+1]-tbands[b])/4;
-       leakage_from[b] = MIN16(leakage_from[b+1]+leak_slope, leakage_from[b]);
-       leakage_to[b] = MAX16(leakage_to[b+1]-leak_slope, leakage_to[b]);
-    }
-    celt_assert(NB_TBANDS+1 <= LEAK_BANDS);
-    for (b=0;b<NB_TBANDS+1;b++)
-    {
-       /* leak_boost[] is made up of two terms. The first, based on leakage_to[],
-          represents the boost needed to overcome the amount of analysis leakage
-          cause in a weaker band b by louder neighbouring bands.
-          The second, based on leakage_from[], applies to a loud band b for
-          which the quantization noise causes synthesis leakage to the weaker
-          neighbouring bands. */
-       float boost = MAX16(0, leakage_to[b] - band_log2[b]) +
-             MAX16(0, band_log2[b] - (leakage_from[b]+LEAKAGE_OFFSET));
-       info->leak_boost[b] = IMIN(255, (int)floor(.5 + 64.f*boost));
+       /* The energy of the very first band is special because of DC. */
+       {
+          float E = 0;
+          float X1r, X2r;
+          X1r = 2*(float)out[0].r;
+          X2r = 2*(float)out[0].i;
+          E = X1r*X1r + X2r*X2r;
+          for (i=1;i<4;i++)
+          {
+             float binE = out[i].r*(float)out[i].r + out[N-i].r*(float)out[N-i].r
+                        + out[i].i*(float)out[i].i + out[N-i].i*(float)out[N-i].i;
+             E += binE;
+          }
+          E = SCALE_ENER(E);
+          band_log2[0] = .5f*1.442695f*(float)log(E+1e-10f);
+       }
+       for (b=0;b<NB_TBANDS;b++)
+          band_log2[b+1] = .5f*1.442695f*(float)log(bandE[b]+1e-10f);
+       leakage_from[0] = band_log2[0];
+       leakage_to[0] = band_log2[0] - LEAKAGE_OFFSET;
+       for (b=1;b<NB_TBANDS+1;b++)
+       {
+          float leak_slope = LEAKAGE_SLOPE*(tbands[b]-tbands[b-1])/4;
+          leakage_from[b] = MIN16(leakage_from[b-1]+leak_slope, band_log2[b]);
+          leakage_to[b] = MAX16(leakage_to[b-1]-leak_slope, band_log2[b]-LEAKAGE_OFFSET);
+       }
+       for (b=NB_TBANDS-2;b>=0;b--)
+       {
+          float leak_slope = LEAKAGE_SLOPE*(tbands[b+1]-tbands[b])/4;
+          leakage_from[b] = MIN16(leakage_from[b+1]+leak_slope, leakage_from[b]);
+          leakage_to[b] = MAX16(leakage_to[b+1]-leak_slope, leakage_to[b]);
+       }
+       celt_assert(NB_TBANDS+1 <= LEAK_BANDS);
+       for (b=0;b<NB_TBANDS+1;b++)
+       {
+          /* leak_boost[] is made up of two terms. The first, based on leakage_to[],
+             represents the boost needed to overcome the amount of analysis leakage
+             cause in a weaker band b by louder neighbouring bands.
+             The second, based on leakage_from[], applies to a loud band b for
+             which the quantization noise causes synthesis leakage to the weaker
+             neighbouring bands. */
+          float boost = MAX16(0, leakage_to[b] - band_log2[b]) +
+                MAX16(0, band_log2[b] - (leakage_from[b]+LEAKAGE_OFFSET));
+          info->leak_boost[b] = IMIN(255, (int)floor(.5 + 64.f*boost));
+       }
+       for (;b<LEAK_BANDS;b++) info->leak_boost[b] = 0;
+    } else {
+       OPUS_CLEAR(info->leak_boost, LEAK_BANDS);
     }
-    for (;b<LEAK_BANDS;b++) info->leak_boost[b] = 0;
 
     for (i=0;i<NB_FRAMES;i++)
     {
@@ -735,103 +855,114 @@ static void tonality_analysis(TonalityAnalysisState *tonal, const CELTMode *celt
        spec_variability += mindist;
     }
     spec_variability = (float)sqrt(spec_variability/NB_FRAMES/NB_TBANDS);
-    bandwidth_mask = 0;
-    bandwidth = 0;
-    maxE = 0;
-    noise_floor = 5.7e-4f/(1<<(IMAX(0,lsb_depth-8)));
-    noise_floor *= noise_floor;
-    below_max_pitch=0;
-    above_max_pitch=0;
-    for (b=0;b<NB_TBANDS;b++)
+    info->max_pitch_ratio = 1;
+    if (outputs & ANALYSIS_MAX_PITCH)
     {
-       float E=0;
-       float Em;
-       int band_start, band_end;
-       /* Keep a margin of 300 Hz for aliasing */
-       band_start = tbands[b];
-       band_end = tbands[b+1];
-       for (i=band_start;i<band_end;i++)
+       below_max_pitch=0;
+       above_max_pitch=0;
+       for (b=0;b<NB_TBANDS;b++)
        {
-          float binE = out[i].r*(float)out[i].r + out[N-i].r*(float)out[N-i].r
-                     + out[i].i*(float)out[i].i + out[N-i].i*(float)out[N-i].i;
-          E += binE;
+          if (tbands[b] < 64)
+             below_max_pitch += bandE[b];
+          else
+             above_max_pitch += bandE[b];
        }
-       E = SCALE_ENER(E);
-       maxE = MAX32(maxE, E);
-       if (band_start < 64)
+       if (tonal->Fs == 48000)
        {
-          below_max_pitch += E;
-       } else {
+          float E = hp_ener*(1.f/(60*60));
+#ifdef FIXED_POINT
+          /* silk_resampler_down2_hp() shifted right by an extra 8 bits. */
+          E *= 256.f*(1.f/Q15ONE)*(1.f/Q15ONE);
+#endif
           above_max_pitch += E;
        }
-       tonal->meanE[b] = MAX32((1-alphaE2)*tonal->meanE[b], E);
-       Em = MAX32(E, tonal->meanE[b]);
-       /* Consider the band "active" only if all these conditions are met:
-          1) less than 90 dB below the peak band (maximal masking possible considering
-             both the ATH and the loudness-dependent slope of the spreading function)
-          2) above the PCM quantization noise floor
-          We use b+1 because the first CELT band isn't included in tbands[]
-       */
-       if (E*1e9f > maxE && (Em > 3*noise_floor*(band_end-band_start) || E > noise_floor*(band_end-band_start)))
-          bandwidth = b+1;
-       /* Check if the band is masked (see below). */
-       is_masked[b] = E < (tonal->prev_bandwidth >= b+1  ? .01f : .05f)*bandwidth_mask;
-       /* Use a simple follower with 13 dB/Bark slope for spreading function. */
-       bandwidth_mask = MAX32(.05f*bandwidth_mask, E);
+       if (above_max_pitch > below_max_pitch)
+          info->max_pitch_ratio = below_max_pitch/above_max_pitch;
     }
-    /* Special case for the last two bands, for which we don't have spectrum but only
-       the energy above 12 kHz. The difficulty here is that the high-pass we use
-       leaks some LF energy, so we need to increase the threshold without accidentally cutting
-       off the band. */
-    if (tonal->Fs == 48000) {
-       float noise_ratio;
-       float Em;
-       float E = hp_ener*(1.f/(60*60));
-       noise_ratio = tonal->prev_bandwidth==20 ? 10.f : 30.f;
+    bandwidth = 0;
+    if (outputs & ANALYSIS_BANDWIDTH)
+    {
+       bandwidth_mask = 0;
+       maxE = 0;
+       noise_floor = 5.7e-4f/(1<<(IMAX(0,lsb_depth-8)));
+       noise_floor *= noise_floor;
+       for (b=0;b<NB_TBANDS;b++)
+       {
+          float E=0;
+          float Em;
+          int band_start, band_end;
+          /* Keep a margin of 300 Hz for aliasing */
+          band_start = tbands[b];
+          band_end = tbands[b+1];
+          for (i=band_start;i<band_end;i++)
+          {
+             float binE = out[i].r*(float)out[i].r + out[N-i].r*(float)out[N-i].r
+                        + out[i].i*(float)out[i].i + out[N-i].i*(float)out[N-i].i;
+             E += binE;
+          }
+          E = SCALE_ENER(E);
+          maxE = MAX32(maxE, E);
+          tonal->meanE[b] = MAX32((1-alphaE2)*tonal->meanE[b], E);
+          Em = MAX32(E, tonal->meanE[b]);
+          /* Consider the band "active" only if all these conditions are met:
+             1) less than 90 dB below the peak band (maximal masking possible considering
+                both the ATH and the loudness-dependent slope of the spreading function)
+             2) above the PCM quantization noise floor
+             We use b+1 because the first CELT band isn't included in tbands[]
+          */
+          if (E*1e9f > maxE && (Em > 3*noise_floor*(band_end-band_start) || E > noise_floor*(band_end-band_start)))
+             bandwidth = b+1;
+          /* Check if the band is masked (see below). */
+          is_masked[b] = E < (tonal->prev_bandwidth >= b+1  ? .01f : .05f)*bandwidth_mask;
+          /* Use a simple follower with 13 dB/Bark slope for spreading function. */
+          bandwidth_mask = MAX32(.05f*bandwidth_mask, E);
+       }
+       /* Special case for the last two bands, for which we don't have spectrum but only
+          the energy above 12 kHz. The difficulty here is that the high-pass we use
+          leaks some LF energy, so we need to increase the threshold without accidentally cutting
+          off the band. */
+       if (tonal->Fs == 48000) {
+          float noise_ratio;
+          float Em;
+          float E = hp_ener*(1.f/(60*60));
+          noise_ratio = tonal->prev_bandwidth==20 ? 10.f : 30.f;
 
 #ifdef FIXED_POINT
-       /* silk_resampler_down2_hp() shifted right by an extra 8 bits. */
-       E *= 256.f*(1.f/Q15ONE)*(1.f/Q15ONE);
+          /* silk_resampler_down2_hp() shifted right by an extra 8 bits. */
+          E *= 256.f*(1.f/Q15ONE)*(1.f/Q15ONE);
 #endif
-       above_max_pitch += E;
-       tonal->meanE[b] = MAX32((1-alphaE2)*tonal->meanE[b], E);
-       Em = MAX32(E, tonal->meanE[b]);
-       if (Em > 3*noise_ratio*noise_floor*160 || E > noise_ratio*noise_floor*160)
+          tonal->meanE[b] = MAX32((1-alphaE2)*tonal->meanE[b], E);
+          Em = MAX32(E, tonal->meanE[b]);
+          if (Em > 3*noise_ratio*noise_floor*160 || E > noise_ratio*noise_floor*160)
+             bandwidth = 20;
+          /* Check if the band is masked (see below). */
+          is_masked[b] = E < (tonal->prev_bandwidth == 20  ? .01f : .05f)*bandwidth_mask;
+       }
+       /* In some cases, resampling aliasing can create a small amount of energy in the first band
+          being cut. So if the last band is masked, we don't include it.  */
+       if (bandwidth == 20 && is_masked[NB_TBANDS])
+          bandwidth-=2;
+       else if (bandwidth > 0 && bandwidth <= NB_TBANDS && is_masked[bandwidth-1])
+          bandwidth--;
+       if (tonal->count<=2)
           bandwidth = 20;
-       /* Check if the band is masked (see below). */
-       is_masked[b] = E < (tonal->prev_bandwidth == 20  ? .01f : .05f)*bandwidth_mask;
     }
-    if (above_max_pitch > below_max_pitch)
-       info->max_pitch_ratio = below_max_pitch/above_max_pitch;
-    else
-       info->max_pitch_ratio = 1;
-    /* In some cases, resampling aliasing can create a small amount of energy in the first band
-       being cut. So if the last band is masked, we don't include it.  */
-    if (bandwidth == 20 && is_masked[NB_TBANDS])
-       bandwidth-=2;
-    else if (bandwidth > 0 && bandwidth <= NB_TBANDS && is_masked[bandwidth-1])
-       bandwidth--;
-    if (tonal->count<=2)
-       bandwidth = 20;
     frame_loudness = 20*(float)log10(frame_loudness);
     tonal->Etracker = MAX32(tonal->Etracker-.003f, frame_loudness);
     tonal->lowECount *= (1-alphaE);
     if (frame_loudness < tonal->Etracker-30)
        tonal->lowECount += alphaE;
 
-    for (i=0;i<8;i++)
-    {
-       float sum=0;
-       for (b=0;b<16;b++)
-          sum += dct_table[i*16+b]*logE[b];
-       BFCC[i] = sum;
-    }
-    for (i=0;i<8;i++)
+    OPUS_CLEAR(BFCC, 8);
+    OPUS_CLEAR(midE, 8);
+    for (b=0;b<16;b++)
     {
-       float sum=0;
-       for (b=0;b<16;b++)
-          sum += dct_table[i*16+b]*.5f*(tonal->highE[b]+tonal->lowE[b]);
-       midE[i] = sum;
+       float m = .5f*(tonal->highE[b]+tonal->lowE[b]);
+       for (i=0;i<8;i++)
+       {
+          BFCC[i] += dct_table[b*8+i]*logE[b];
+          midE[i] += dct_table[b*8+i]*m;
+       }
     }
 
     frame_stationarity /= NB_TBANDS;
@@ -889,16 +1020,10 @@ static void tonality_analysis(TonalityAnalysisState *tonal, const CELTMode *celt
     features[22] = frame_stationarity - 0.743717f;
     features[23] = info->tonality_slope + 0.069216f;
     features[24] = tonal->lowECount - 0.067930f;
+    ANALYSIS_PROFILE_END(tonal, ANALYSIS_STAGE_FEATURES);
 
-    compute_dense(&layer0, layer_out, features);
-    compute_gru(&layer1, tonal->rnn_state, layer_out);
-    compute_dense(&layer2, frame_probs, tonal->rnn_state);
+    analysis_mlp(tonal, info, features);
 
-    /* Probability of speech or music vs noise */
-    info->activity_probability = frame_probs[1];
-    info->music_prob = frame_probs[0];
-
-    /*printf("%f %f %f\n", frame_probs[0], frame_probs[1], info->music_prob);*/
 #ifdef MLP_TRAINING
     for (i=0;i<25;i++)
        printf("%f ", features[i]);
@@ -910,6 +1035,189 @@ static void tonality_analysis(TonalityAnalysisState *tonal, const CELTMode *celt
     /*printf("%d %d\n", info->bandwidth, info->opus_bandwidth);*/
     info->noisiness = frame_noisiness;
     info->valid = 1;
+}
+
+static void tonality_analysis(TonalityAnalysisState *tonal, const CELTMode *celt_mode, const void *x, int len, int offset, int c1, int c2, int C, int lsb_depth, downmix_func downmix)
+{
+    int i, b;
+    const kiss_fft_state *kfft;
+    VARDECL(kiss_fft_cpx, in);
+    VARDECL(kiss_fft_cpx, out);
+    int N = 480, N2=240;
+    float * OPUS_RESTRICT A = tonal->angle;
+    float * OPUS_RESTRICT dA = tonal->d_angle;
+    float * OPUS_RESTRICT d2A = tonal->d2_angle;
+    VARDECL(float, tonality);
+    VARDECL(float, noisiness);
+    float bandE[NB_TBANDS];
+    float band_tE[NB_TBANDS];
+    float band_nE[NB_TBANDS];
+    int remaining;
+    AnalysisInfo *info;
+    float hp_ener;
+    float tonality2[240];
+    int skip;
+    int hp;
+    SAVE_STACK;
+
+    if (tonal->Fs == 48000)
+    {
+       /* len and offset are now at 24 kHz. */
+       len/= 2;
+       offset /= 2;
+    } else if (tonal->Fs == 16000) {
+       len = 3*len/2;
+       offset = 3*offset/2;
+    }
+
+    kfft = celt_mode->mdct.kfft[0];
+    /* The energy above 12 kHz is only used for the bandwidth and max_pitch_ratio */
+    hp = (tonal->outputs & ANALYSIS_MAX_PITCH) || ((tonal->outputs & ANALYSIS_BANDWIDTH) && tonal->decimation <= 1);
+    /* Only on the very first call: frames shorter than 20 ms don't complete
+       a window, so count can still be 0 on the next call. */
+    if (tonal->count==0 && tonal->mem_fill==0)
+       tonal->mem_fill = 240;
+    ANALYSIS_PROFILE_BEGIN(tonal, ANALYSIS_STAGE_DOWNMIX);
+    tonal->hp_ener_accum += (float)downmix_and_resample(downmix, x,
+          &tonal->inmem[tonal->mem_fill], tonal->downmix_state,
+          IMIN(len, ANALYSIS_BUF_SIZE-tonal->mem_fill), offset, c1, c2, C, tonal->Fs, hp);
+    ANALYSIS_PROFILE_END(tonal, ANALYSIS_STAGE_DOWNMIX);
+    if (tonal->mem_fill+len < ANALYSIS_BUF_SIZE)
+    {
+       tonal->mem_fill += len;
+       /* Don't have enough to update the analysis */
+       RESTORE_STACK;
+       return;
+    }
+    hp_ener = tonal->hp_ener_accum;
+    info = &tonal->info[tonal->write_pos++];
+    if (tonal->write_pos>=DETECT_SIZE)
+       tonal->write_pos-=DETECT_SIZE;
+    /* In fast mode, the first window is always analyzed */
+    skip = tonal->count > 0 && tonal->skipped < IMIN(tonal->decimation, ANALYSIS_MAX_DECIMATION)-1;
+
+    ALLOC(in, 480, kiss_fft_cpx);
+    ALLOC(out, 480, kiss_fft_cpx);
+    ALLOC(tonality, 240, float);
+    ALLOC(noisiness, 240, float);
+    if (!skip)
+    {
+       ANALYSIS_PROFILE_BEGIN(tonal, ANALYSIS_STAGE_FFT);
+       for (i=0;i<N2;i++)
+       {
+          float w = analysis_window[i];
+          in[i].r = (kiss_fft_scalar)(w*tonal->inmem[i]);
+          in[i].i = (kiss_fft_scalar)(w*tonal->inmem[N2+i]);
+          in[N-i-1].r = (kiss_fft_scalar)(w*tonal->inmem[N-i-1]);
+          in[N-i-1].i = (kiss_fft_scalar)(w*tonal->inmem[N+N2-i-1]);
+       }
+       ANALYSIS_PROFILE_PAUSE(tonal, ANALYSIS_STAGE_FFT);
+    }
+    OPUS_MOVE(tonal->inmem, tonal->inmem+ANALYSIS_BUF_SIZE-240, 240);
+    remaining = len - (ANALYSIS_BUF_SIZE-tonal->mem_fill);
+    ANALYSIS_PROFILE_BEGIN(tonal, ANALYSIS_STAGE_DOWNMIX);
+    tonal->hp_ener_accum = (float)downmix_and_resample(downmix, x,
+          &tonal->inmem[240], tonal->downmix_state, remaining,
+          offset+ANALYSIS_BUF_SIZE-tonal->mem_fill, c1, c2, C, tonal->Fs, hp);
+    ANALYSIS_PROFILE_END(tonal, ANALYSIS_STAGE_DOWNMIX);
+    tonal->mem_fill = 240 + remaining;
+    if (skip)
+    {
+       /* Resolved when the next window is analyzed, until then it repeats
+          the result of the previous one. */
+       OPUS_COPY(info, &tonal->info[(info - tonal->info + DETECT_SIZE - 1) % DETECT_SIZE], 1);
+       tonal->skipped_hp_ener[tonal->skipped++] = hp_ener;
+       RESTORE_STACK;
+       return;
+    }
+    if (tonal->skipped)
+    {
+       /* Carry the phase of the last analyzed window over the skipped ones
+          with its derivative, as if they had been analyzed. */
+       for (i=1;i<N2;i++)
+          A[i] += 2*tonal->skipped*dA[i];
+    }
+    ANALYSIS_PROFILE_BEGIN(tonal, ANALYSIS_STAGE_FFT);
+    opus_fft(kfft, in, out, tonal->arch);
+    ANALYSIS_PROFILE_END(tonal, ANALYSIS_STAGE_FFT);
+#ifndef FIXED_POINT
+    /* If there's any NaN on the input, the entire output will be NaN, so we only need to check one value. */
+    if (celt_isnan(out[0].r))
+    {
+       info->valid = 0;
+       drop_skipped(tonal, info);
+       RESTORE_STACK;
+       return;
+    }
+#endif
+
+    ANALYSIS_PROFILE_BEGIN(tonal, ANALYSIS_STAGE_TONALITY);
+    tonality_bins(out, N, 1, A, dA, d2A, tonality, tonality2, noisiness, tonal->arch);
+    for (i=2;i<N2-1;i++)
+    {
+       float tt = MIN32(tonality2[i], MAX32(tonality2[i-1], tonality2[i+1]));
+       tonality[i] = .9f*MAX32(tonality[i], tt-.1f);
+    }
+    for (b=0;b<NB_TBANDS;b++)
+    {
+       float E=0, tE=0, nE=0;
+       for (i=tbands[b];i<tbands[b+1];i++)
+       {
+          float binE = out[i].r*(float)out[i].r + out[N-i].r*(float)out[N-i].r
+                     + out[i].i*(float)out[i].i + out[N-i].i*(float)out[N-i].i;
+          binE = SCALE_ENER(binE);
+          E += binE;
+          tE += binE*MAX32(0, tonality[i]);
+          nE += binE*2.f*(.5f-noisiness[i]);
+       }
+#ifndef FIXED_POINT
+       /* Check for extreme band energies that could cause NaNs later. */
+       if (!(E<1e9f) || celt_isnan(E))
+       {
+          info->valid = 0;
+          drop_skipped(tonal, info);
+          RESTORE_STACK;
+          return;
+       }
+#endif
+       bandE[b] = E;
+       band_tE[b] = tE;
+       band_nE[b] = nE;
+    }
+    ANALYSIS_PROFILE_END(tonal, ANALYSIS_STAGE_TONALITY);
+
+    if (tonal->skipped)
+    {
+       /* Fast mode: the skipped windows get the band energies interpolated
+          (in the log domain) between the last analyzed window and this one,
+          and their tonal and noisy ratios interpolated linearly, so that the
+          trackers and the MLP still run every 20 ms. */
+       int j;
+       for (j=0;j<tonal->skipped;j++)
+       {
+          float E[NB_TBANDS], tE[NB_TBANDS], nE[NB_TBANDS];
+          float w = (j+1.f)/(tonal->skipped+1);
+          AnalysisInfo *skipped_info = &tonal->info[(info - tonal->info + DETECT_SIZE - tonal->skipped + j) % DETECT_SIZE];
+          ANALYSIS_PROFILE_BEGIN(tonal, ANALYSIS_STAGE_TONALITY);
+          for (b=0;b<NB_TBANDS;b++)
+          {
+             float E0 = tonal->last_bandE[b], E1 = bandE[b];
+             E[b] = E0*(float)pow((E1+1e-10f)/(E0+1e-10f), w);
+             tE[b] = E[b]*((1-w)*tonal->last_band_tE[b]/(1e-15f+E0) + w*band_tE[b]/(1e-15f+E1));
+             nE[b] = E[b]*((1-w)*tonal->last_band_nE[b]/(1e-15f+E0) + w*band_nE[b]/(1e-15f+E1));
+          }
+          ANALYSIS_PROFILE_PAUSE(tonal, ANALYSIS_STAGE_TONALITY);
+          tonality_features(tonal, skipped_info, NULL, E, tE, nE, tonal->skipped_hp_ener[j], lsb_depth);
+       }
+       tonal->skipped = 0;
+    }
+    if (tonal->decimation > 1)
+    {
+       OPUS_COPY(tonal->last_bandE, bandE, NB_TBANDS);
+       OPUS_COPY(tonal->last_band_tE, band_tE, NB_TBANDS);
+       OPUS_COPY(tonal->last_band_nE, band_nE, NB_TBANDS);
+    }
+    tonality_features(tonal, info, out, bandE, band_tE, band_nE, hp_ener, lsb_depth);
     RESTORE_STACK;
 }
 
@@ -938,8 +1246,87 @@ void run_analysis(TonalityAnalysisState *analysis, const CELTMode *celt_mode, co
       analysis->analysis_offset -= frame_size;
    }
 
-   analysis_info->valid = 0;
-   tonality_get_info(analysis, analysis_info, frame_size);
+   if (analysis_info != NULL)
+   {
+      analysis_info->valid = 0;
+      tonality_get_info(analysis, analysis_info, frame_size);
+   }
+}
+
+void tonality_analysis_mlp(TonalityAnalysisState **analysis, float *rnn_state, int B)
+{
+   int b;
+   /* The analyses of a batch share the network of the first one */
+   const MLPModel *model = analysis[0]->model;
+   float input[MAX_BATCH*MAX_NEURONS];
+   float layer_out[MAX_BATCH*MAX_NEURONS];
+   float frame_probs[MAX_BATCH*MAX_NEURONS];
+   float saved_state[MAX_BATCH*MAX_NEURONS];
+   celt_assert(B <= MAX_BATCH);
+   /* One window of every analysis per batch. The analyses normally have the
+      same number of pending windows, the others (and windows without
+      features, see the NaN checks) go through with zero input and keep
+      their GRU state. In fast mode, the skipped windows wait for the next
+      analyzed one. */
+   while (1)
+   {
+      int pos[MAX_BATCH];
+      int valid[MAX_BATCH];
+      int active = 0;
+      for (b=0;b<B;b++)
+      {
+         TonalityAnalysisState *tonal = analysis[b];
+         pos[b] = tonal->mlp_pos;
+         valid[b] = 0;
+         if (pos[b] != (tonal->write_pos + DETECT_SIZE - tonal->skipped) % DETECT_SIZE)
+         {
+            active = 1;
+            valid[b] = tonal->info[pos[b]].valid;
+            tonal->mlp_pos++;
+            if (tonal->mlp_pos>=DETECT_SIZE)
+               tonal->mlp_pos-=DETECT_SIZE;
+         }
+         if (valid[b])
+         {
+            OPUS_COPY(&input[b*MAX_NEURONS], &tonal->mlp_features[pos[b]*MAX_NEURONS], 25);
+         } else {
+            OPUS_CLEAR(&input[b*MAX_NEURONS], 25);
+            OPUS_COPY(&saved_state[b*MAX_NEURONS], &rnn_state[b*MAX_NEURONS], MAX_NEURONS);
+         }
+      }
+      if (!active)
+         break;
+      /* Timed in the first analysis of the batch */
+      ANALYSIS_PROFILE_BEGIN(analysis[0], ANALYSIS_STAGE_MLP);
+      compute_dense_batch(model->layer0, layer_out, input, B);
+      compute_gru_batch(model->layer1, rnn_state, layer_out, B);
+      compute_dense_batch(model->layer2, frame_probs, rnn_state, B);
+      ANALYSIS_PROFILE_END(analysis[0], ANALYSIS_STAGE_MLP);
+      for (b=0;b<B;b++)
+      {
+         if (valid[b])
+         {
+            /* Probability of speech or music vs noise */
+            analysis[b]->info[pos[b]].activity_probability = frame_probs[b*MAX_NEURONS + 1];
+            analysis[b]->info[pos[b]].music_prob = frame_probs[b*MAX_NEURONS];
+         } else {
+            OPUS_COPY(&rnn_state[b*MAX_NEURONS], &saved_state[b*MAX_NEURONS], MAX_NEURONS);
+         }
+      }
+   }
+   /* The skipped windows repeat the last result until they are resolved */
+   for (b=0;b<B;b++)
+   {
+      TonalityAnalysisState *tonal = analysis[b];
+      int i;
+      for (i=0;i<tonal->skipped;i++)
+      {
+         AnalysisInfo *last = &tonal->info[(tonal->mlp_pos + DETECT_SIZE - 1) % DETECT_SIZE];
+         AnalysisInfo *info = &tonal->info[(tonal->mlp_pos + i) % DETECT_SIZE];
+         info->activity_probability = last->activity_probability;
+         info->music_prob = last->music_prob;
+      }
+   }
 }
 
 #endif /* DISABLE_FLOAT_API */
@@ -29,6 +29,7 @@
 #define ANALYSIS_H
 
 #include "celt.h"
+#include "kiss_fft.h"
 #include "opus_private.h"
 #include "mlp.h"
 
@@ -41,13 +42,54 @@
 
 #define DETECT_SIZE 100
 
+/* Highest decimation of the fast mode, see run_analysis() */
+#define ANALYSIS_MAX_DECIMATION 3
+
+/* Results of the analysis that only the encoder needs, for
+   TonalityAnalysisState.outputs. Without them the corresponding AnalysisInfo
+   fields are 0 (max_pitch_ratio 1) and their stages do not run; the music
+   and voice activity probabilities, tonality and noisiness are always
+   computed. */
+#define ANALYSIS_BANDWIDTH 1           /* bandwidth */
+#define ANALYSIS_LEAKAGE 2             /* leak_boost[] */
+#define ANALYSIS_MAX_PITCH 4           /* max_pitch_ratio */
+#define ANALYSIS_ALL (ANALYSIS_BANDWIDTH|ANALYSIS_LEAKAGE|ANALYSIS_MAX_PITCH)
+
+/* Stages of the analysis timed with ANALYSIS_PROFILE (--enable-analysis-profile) */
+#define ANALYSIS_STAGE_DOWNMIX 0       /* downmix_and_resample() */
+#define ANALYSIS_STAGE_FFT 1           /* windowing and opus_fft() */
+#define ANALYSIS_STAGE_TONALITY 2      /* phase/tonality loop and band energies */
+#define ANALYSIS_STAGE_FEATURES 3      /* trackers, BFCC and MLP features (bandwidth, leakage, ...) */
+#define ANALYSIS_STAGE_MLP 4           /* MLP, direct or batched */
+#define ANALYSIS_STAGE_GET_INFO 5      /* tonality_get_info() */
+#define ANALYSIS_STAGES 6
+
+/* Time spent in each stage, in ticks of a cycle counter (TSC on x86,
+   nanoseconds elsewhere), and the number of times it ran. */
+typedef struct {
+   opus_uint64 ticks[ANALYSIS_STAGES];
+   opus_uint64 calls[ANALYSIS_STAGES];
+   opus_uint64 start[ANALYSIS_STAGES];
+} AnalysisProfile;
+
 /* Uncomment this to print the MLP features on stdout. */
 /*#define MLP_TRAINING*/
 
+/* ANALYSIS_INT16_FEATURES (configure --enable-analysis-int16-features)
+   quantizes the MLP features to int16 (MLP_INPUT_SHIFT fractional bits) and
+   computes the first layer with integer products. */
+
 typedef struct {
    int arch;
    int application;
    opus_int32 Fs;
+   float *mlp_features;                 /* if not NULL, the MLP is deferred, see tonality_analysis_mlp() */
+   int decimation;                      /* analyze one 20 ms window in decimation (fast mode), see run_analysis() */
+   int outputs;                         /* ANALYSIS_* results to compute (default: ANALYSIS_ALL) */
+   const MLPModel *model;               /* network of the MLP (default: &mlp_default_model) */
+#ifdef ANALYSIS_PROFILE
+   AnalysisProfile profile;             /* accumulated since tonality_analysis_init(), not reset */
+#endif
 #define TONALITY_ANALYSIS_RESET_START angle
    float angle[240];
    float d_angle[240];
@@ -73,8 +115,14 @@ typedef struct {
    int write_pos;
    int read_pos;
    int read_subframe;
+   int mlp_pos;                         /* first info[] entry whose deferred MLP has not run yet */
+   int skipped;                         /* windows waiting for the next analyzed one (fast mode) */
    float hp_ener_accum;
    float rnn_state[MAX_NEURONS];
+   float skipped_hp_ener[ANALYSIS_MAX_DECIMATION-1]; /* energy above 12 kHz of the skipped windows */
+   float last_bandE[NB_TBANDS];         /* band energies of the last analyzed window (fast mode) */
+   float last_band_tE[NB_TBANDS];
+   float last_band_nE[NB_TBANDS];
    opus_val32 downmix_state[3];
    AnalysisInfo info[DETECT_SIZE];
 } TonalityAnalysisState;
@@ -95,8 +143,67 @@ void tonality_analysis_reset(TonalityAnalysisState *analysis);
 
 void tonality_get_info(TonalityAnalysisState *tonal, AnalysisInfo *info_out, int len);
 
+/** Get the CELT mode to pass to run_analysis() when there is no encoder.
+ *
+ * This is the compiled-in 48 kHz mode (see celt_static_mode()), one read-only
+ * instance with its FFT setup for the whole process, which any number of
+ * analysis states can share across threads without locking. Returns NULL
+ * when the library is built with CUSTOM_MODES_ONLY.
+ */
+const CELTMode *tonality_analysis_mode(void);
+
+/** Get the time spent in each stage since tonality_analysis_init().
+ *
+ * Returns 1, or 0 (with the profile cleared) when the analysis was built
+ * without ANALYSIS_PROFILE, which then costs nothing.
+ */
+int tonality_analysis_profile(const TonalityAnalysisState *tonal, AnalysisProfile *profile);
+
+/** Analyze the new samples and get the result of the frame in analysis_info.
+ *
+ * With analysis_info NULL only the analysis is run, the result can be read
+ * later with tonality_get_info() (e.g. after tonality_analysis_mlp()).
+ *
+ * With decimation n > 1 (fast mode, up to ANALYSIS_MAX_DECIMATION) the FFT
+ * and the tonality of only one 20 ms window in n are computed. The band
+ * energies of the windows in between are interpolated once the next window
+ * is analyzed, which resolves their result n-1 windows late (until then they
+ * repeat the previous one). The bandwidth and leak_boost are not computed in
+ * this mode (0), whatever outputs says.
+ */
 void run_analysis(TonalityAnalysisState *analysis, const CELTMode *celt_mode, const void *analysis_pcm,
                  int analysis_frame_size, int frame_size, int c1, int c2, int C, opus_int32 Fs,
                  int lsb_depth, downmix_func downmix, AnalysisInfo *analysis_info);
 
+/** Phase tracking and tonality of the bins start to N/2-1 of one window.
+ *
+ * out is the FFT of the window (two real half-windows packed in one complex
+ * FFT of size N), A, dA and d2A are the angle, angle derivative and second
+ * derivative tracked for each bin from one window to the next. This is the
+ * reference version, tonality_bins() selects the fastest one for the CPU.
+ */
+void tonality_bins_c(const kiss_fft_cpx *out, int N, int start, float *A, float *dA, float *d2A,
+      float *tonality, float *tonality2, float *noisiness);
+
+#if !defined(FIXED_POINT) && defined(OPUS_X86_MAY_HAVE_SSE4_1)
+#include "x86/analysis_sse.h"
+#endif
+
+#if !defined(OVERRIDE_TONALITY_BINS)
+#define tonality_bins(out, N, start, A, dA, d2A, tonality, tonality2, noisiness, arch) \
+    ((void)(arch), tonality_bins_c(out, N, start, A, dA, d2A, tonality, tonality2, noisiness))
+#endif
+
+/** Run the deferred MLP of B analyses at once.
+ *
+ * When mlp_features points to DETECT_SIZE*MAX_NEURONS floats, the analysis
+ * stores the features of each window there instead of running the MLP. This
+ * evaluates the MLP of all the pending windows of the B analyses as batches
+ * (at most MAX_BATCH), with the GRU states taken from rnn_state (B rows of
+ * MAX_NEURONS floats, zero at the start) instead of the analysis states.
+ * The B analyses must use the same model. It has to be called before
+ * tonality_get_info().
+ */
+void tonality_analysis_mlp(TonalityAnalysisState **analysis, float *rnn_state, int B);
+
 #endif
@@ -69,7 +69,13 @@ static OPUS_INLINE float sigmoid_approx(float x)
    return .5f + .5f*tansig_approx(.5f*x);
 }
 
-void compute_dense(const DenseLayer *layer, float *output, const float *input)
+const MLPModel mlp_default_model = {
+   &layer0,
+   &layer1,
+   &layer2
+};
+
+void compute_dense_c(const DenseLayer *layer, float *output, const float *input)
 {
    int i, j;
    int N, M;
@@ -94,7 +100,31 @@ void compute_dense(const DenseLayer *layer, float *output, const float *input)
    }
 }
 
-void compute_gru(const GRULayer *gru, float *state, const float *input)
+void compute_dense_int16(const DenseLayer *layer, float *output, const opus_int16 *input)
+{
+   int i, j;
+   int N, M;
+   int stride;
+   M = layer->nb_inputs;
+   N = layer->nb_neurons;
+   stride = N;
+   for (i=0;i<N;i++)
+   {
+      opus_int32 sum = (opus_int32)layer->bias[i]*(1<<MLP_INPUT_SHIFT);
+      for (j=0;j<M;j++)
+         sum += layer->input_weights[j*stride + i]*(opus_int32)input[j];
+      output[i] = (WEIGHTS_SCALE/(1<<MLP_INPUT_SHIFT))*sum;
+   }
+   if (layer->sigmoid) {
+      for (i=0;i<N;i++)
+         output[i] = sigmoid_approx(output[i]);
+   } else {
+      for (i=0;i<N;i++)
+         output[i] = tansig_approx(output[i]);
+   }
+}
+
+void compute_gru_c(const GRULayer *gru, float *state, const float *input)
 {
    int i, j;
    int N, M;
@@ -139,3 +169,136 @@ void compute_gru(const GRULayer *gru, float *state, const float *input)
       state[i] = h[i];
 }
 
+
+/* The batched layers work on batch-minor copies of the rows, and their inner
+   loops always run over the MAX_BATCH lanes (unused lanes are zero): the
+   constant trip count lets the compiler vectorize them. The sums are
+   accumulated in the same order as in compute_dense_c() and compute_gru_c(). */
+static OPUS_INLINE void transpose_batch(float *out, const float *in, int M, int B)
+{
+   int j, b;
+   for (j=0;j<M;j++)
+   {
+      for (b=0;b<MAX_BATCH;b++)
+         out[j*MAX_BATCH + b] = (b<B) ? in[b*MAX_NEURONS + j] : 0;
+   }
+}
+
+void compute_dense_batch(const DenseLayer *layer, float *output, const float *input, int B)
+{
+   int i, j, b;
+   int N, M;
+   int stride;
+   float x[MAX_NEURONS*MAX_BATCH];
+   float sum[MAX_NEURONS*MAX_BATCH];
+   M = layer->nb_inputs;
+   N = layer->nb_neurons;
+   stride = N;
+   celt_assert(B <= MAX_BATCH);
+   transpose_batch(x, input, M, B);
+   for (i=0;i<N;i++)
+   {
+      for (b=0;b<MAX_BATCH;b++)
+         sum[i*MAX_BATCH + b] = layer->bias[i];
+   }
+   for (j=0;j<M;j++)
+   {
+      for (i=0;i<N;i++)
+      {
+         float w = layer->input_weights[j*stride + i];
+         for (b=0;b<MAX_BATCH;b++)
+            sum[i*MAX_BATCH + b] += w*x[j*MAX_BATCH + b];
+      }
+   }
+   for (b=0;b<B;b++)
+   {
+      for (i=0;i<N;i++)
+      {
+         float y = WEIGHTS_SCALE*sum[i*MAX_BATCH + b];
+         output[b*MAX_NEURONS + i] = layer->sigmoid ? sigmoid_approx(y) : tansig_approx(y);
+      }
+   }
+}
+
+void compute_gru_batch(const GRULayer *gru, float *state, const float *input, int B)
+{
+   int i, j, b;
+   int N, M;
+   int stride;
+   float x[MAX_NEURONS*MAX_BATCH];
+   float s[MAX_NEURONS*MAX_BATCH];
+   float z[MAX_NEURONS*MAX_BATCH];
+   float r[MAX_NEURONS*MAX_BATCH];
+   float h[MAX_NEURONS*MAX_BATCH];
+   M = gru->nb_inputs;
+   N = gru->nb_neurons;
+   stride = 3*N;
+   celt_assert(B <= MAX_BATCH);
+   transpose_batch(x, input, M, B);
+   transpose_batch(s, state, N, B);
+   for (i=0;i<N;i++)
+   {
+      for (b=0;b<MAX_BATCH;b++)
+      {
+         z[i*MAX_BATCH + b] = gru->bias[i];
+         r[i*MAX_BATCH + b] = gru->bias[N + i];
+         h[i*MAX_BATCH + b] = gru->bias[2*N + i];
+      }
+   }
+   /* Input part of the update gate, reset gate and output */
+   for (j=0;j<M;j++)
+   {
+      for (i=0;i<N;i++)
+      {
+         float wz = gru->input_weights[j*stride + i];
+         float wr = gru->input_weights[N + j*stride + i];
+         float wh = gru->input_weights[2*N + j*stride + i];
+         for (b=0;b<MAX_BATCH;b++)
+         {
+            z[i*MAX_BATCH + b] += wz*x[j*MAX_BATCH + b];
+            r[i*MAX_BATCH + b] += wr*x[j*MAX_BATCH + b];
+            h[i*MAX_BATCH + b] += wh*x[j*MAX_BATCH + b];
+         }
+      }
+   }
+   /* Recurrent part of the update and reset gates */
+   for (j=0;j<N;j++)
+   {
+      for (i=0;i<N;i++)
+      {
+         float wz = gru->recurrent_weights[j*stride + i];
+         float wr = gru->recurrent_weights[N + j*stride + i];
+         for (b=0;b<MAX_BATCH;b++)
+         {
+            z[i*MAX_BATCH + b] += wz*s[j*MAX_BATCH + b];
+            r[i*MAX_BATCH + b] += wr*s[j*MAX_BATCH + b];
+         }
+      }
+   }
+   for (i=0;i<N;i++)
+   {
+      for (b=0;b<B;b++)
+      {
+         z[i*MAX_BATCH + b] = sigmoid_approx(WEIGHTS_SCALE*z[i*MAX_BATCH + b]);
+         r[i*MAX_BATCH + b] = sigmoid_approx(WEIGHTS_SCALE*r[i*MAX_BATCH + b]);
+      }
+   }
+   /* Recurrent part of the output, which needs the reset gate */
+   for (j=0;j<N;j++)
+   {
+      for (i=0;i<N;i++)
+      {
+         float wh = gru->recurrent_weights[2*N + j*stride + i];
+         for (b=0;b<MAX_BATCH;b++)
+            h[i*MAX_BATCH + b] += wh*s[j*MAX_BATCH + b]*r[j*MAX_BATCH + b];
+      }
+   }
+   for (b=0;b<B;b++)
+   {
+      for (i=0;i<N;i++)
+      {
+         float zi = z[i*MAX_BATCH + b];
+         state[b*MAX_NEURONS + i] = zi*s[i*MAX_BATCH + b] + (1-zi)*tansig_approx(WEIGHTS_SCALE*h[i*MAX_BATCH + b]);
+      }
+   }
+}
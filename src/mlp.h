@@ -53,8 +53,52 @@ extern const DenseLayer layer0;
 extern const GRULayer layer1;
 extern const DenseLayer layer2;
 
-void compute_dense(const DenseLayer *layer, float *output, const float *input);
+/* Network of the analysis: 25 features, a dense layer, a GRU and a dense
+   layer with 2 sigmoid outputs, each at most MAX_NEURONS wide. The weights
+   may also come from a file (see sm/opus_sm_model.h). */
+typedef struct {
+  const DenseLayer *layer0;
+  const GRULayer *layer1;
+  const DenseLayer *layer2;
+} MLPModel;
+
+/* The compiled-in layer0, layer1 and layer2 */
+extern const MLPModel mlp_default_model;
+
+void compute_dense_c(const DenseLayer *layer, float *output, const float *input);
+
+void compute_gru_c(const GRULayer *gru, float *state, const float *input);
+
+/* compute_dense_c() of an input quantized to int16 with MLP_INPUT_SHIFT
+   fractional bits: the products with the int8 weights are accumulated as
+   integers, only the sums are converted to float. */
+#define MLP_INPUT_SHIFT 8
+
+void compute_dense_int16(const DenseLayer *layer, float *output, const opus_int16 *input);
+
+#if defined(OPUS_X86_MAY_HAVE_SSE4_1)
+#include "x86/mlp_sse.h"
+#endif
+
+#if !defined(OVERRIDE_COMPUTE_DENSE)
+#define compute_dense(layer, output, input, arch) \
+    ((void)(arch), compute_dense_c(layer, output, input))
+#endif
+
+#if !defined(OVERRIDE_COMPUTE_GRU)
+#define compute_gru(gru, state, input, arch) \
+    ((void)(arch), compute_gru_c(gru, state, input))
+#endif
+
+/* Batched versions: the same layer for B independent inputs (e.g. B analysis
+   streams), so that each row of weights is read once for the whole batch.
+   Inputs, outputs and states are B rows of MAX_NEURONS floats, B is at most
+   MAX_BATCH. The results are the same as those of B calls of compute_dense_c()
+   and compute_gru_c(). */
+#define MAX_BATCH 16
+
+void compute_dense_batch(const DenseLayer *layer, float *output, const float *input, int B);
 
-void compute_gru(const GRULayer *gru, float *state, const float *input);
+void compute_gru_batch(const GRULayer *gru, float *state, const float *input, int B);
 
 #endif /* _MLP_H_ */
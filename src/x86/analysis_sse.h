@@ -0,0 +1,60 @@
+/* Copyright (c) 2011 Xiph.Org Foundation
+   Written by Jean-Marc Valin */
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef ANALYSIS_SSE_H
+#define ANALYSIS_SSE_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include "cpu_support.h"
+
+#if defined(OPUS_X86_MAY_HAVE_SSE4_1)
+#define OVERRIDE_TONALITY_BINS
+
+void tonality_bins_sse4_1(const kiss_fft_cpx *out, int N, int start, float *A, float *dA, float *d2A,
+      float *tonality, float *tonality2, float *noisiness);
+
+#if defined(OPUS_X86_PRESUME_SSE4_1)
+
+#define tonality_bins(out, N, start, A, dA, d2A, tonality, tonality2, noisiness, arch) \
+    ((void)(arch), tonality_bins_sse4_1(out, N, start, A, dA, d2A, tonality, tonality2, noisiness))
+
+#else
+
+extern void (*const TONALITY_BINS_IMPL[OPUS_ARCHMASK + 1])(
+      const kiss_fft_cpx *out, int N, int start, float *A, float *dA, float *d2A,
+      float *tonality, float *tonality2, float *noisiness);
+
+#define tonality_bins(out, N, start, A, dA, d2A, tonality, tonality2, noisiness, arch) \
+    ((*TONALITY_BINS_IMPL[(arch) & OPUS_ARCHMASK])(out, N, start, A, dA, d2A, tonality, tonality2, noisiness))
+
+#endif
+#endif
+
+#endif
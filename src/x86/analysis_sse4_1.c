@@ -0,0 +1,154 @@
+/* Copyright (c) 2026 The opus_sm contributors */
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include "arch.h"
+#include "mathops.h"
+#include "../analysis.h"
+#include "x86/x86cpu.h"
+
+#if defined(OPUS_X86_MAY_HAVE_SSE4_1) && !defined(FIXED_POINT)
+
+#ifndef M_PI
+#define M_PI 3.141592653
+#endif
+
+/* Same constants as fast_atan2f() in mathops.h */
+#define cA 0.43157974f
+#define cB 0.67848403f
+#define cC 0.08595542f
+#define cE ((float)PI/2)
+
+/* fast_atan2f() of 4 values: both branches are computed and the right one is
+   selected, with the operations in the same order so the results are the same. */
+static OPUS_INLINE __m128 fast_atan2f_sse4_1(__m128 y, __m128 x)
+{
+   const __m128 zero = _mm_setzero_ps();
+   const __m128 signmask = _mm_set1_ps(-0.f);
+   const __m128 e = _mm_set1_ps(cE);
+   const __m128 me = _mm_set1_ps(-cE);
+   __m128 x2, y2, xy, ey, exy, den, r1, r2;
+   x2 = _mm_mul_ps(x, x);
+   y2 = _mm_mul_ps(y, y);
+   xy = _mm_mul_ps(x, y);
+   ey = _mm_blendv_ps(e, me, _mm_cmplt_ps(y, zero));
+   exy = _mm_blendv_ps(e, me, _mm_cmplt_ps(xy, zero));
+   /* x2<y2 */
+   den = _mm_mul_ps(_mm_add_ps(y2, _mm_mul_ps(_mm_set1_ps(cB), x2)),
+                    _mm_add_ps(y2, _mm_mul_ps(_mm_set1_ps(cC), x2)));
+   r1 = _mm_mul_ps(_mm_xor_ps(xy, signmask), _mm_add_ps(y2, _mm_mul_ps(_mm_set1_ps(cA), x2)));
+   r1 = _mm_add_ps(_mm_div_ps(r1, den), ey);
+   /* x2>=y2 */
+   den = _mm_mul_ps(_mm_add_ps(x2, _mm_mul_ps(_mm_set1_ps(cB), y2)),
+                    _mm_add_ps(x2, _mm_mul_ps(_mm_set1_ps(cC), y2)));
+   r2 = _mm_mul_ps(xy, _mm_add_ps(x2, _mm_mul_ps(_mm_set1_ps(cA), y2)));
+   r2 = _mm_sub_ps(_mm_add_ps(_mm_div_ps(r2, den), ey), exy);
+   r1 = _mm_blendv_ps(r2, r1, _mm_cmplt_ps(x2, y2));
+   /* For very small values, the answer is 0 */
+   return _mm_andnot_ps(_mm_cmplt_ps(_mm_add_ps(x2, y2), _mm_set1_ps(1e-18f)), r1);
+}
+
+#undef cA
+#undef cB
+#undef cC
+#undef cE
+
+/* The bins are processed 4 at a time from split arrays: the real and imaginary
+   parts of out[i] and of the mirrored out[N-i] are deinterleaved, the angle
+   history is already one array per quantity. The remaining bins go through
+   tonality_bins_c(). */
+void tonality_bins_sse4_1(const kiss_fft_cpx *out, int N, int start, float *A, float *dA, float *d2A,
+      float *tonality, float *tonality2, float *noisiness)
+{
+   int i;
+   int N2;
+   const float pi4 = (float)(M_PI*M_PI*M_PI*M_PI);
+   const __m128 scale = _mm_set1_ps((float)(.5f/M_PI));
+   const __m128 tscale = _mm_set1_ps(40.f*16.f*pi4);
+   const __m128 one = _mm_set1_ps(1.f);
+   const __m128 offset = _mm_set1_ps(.015f);
+   const __m128 signmask = _mm_set1_ps(-0.f);
+   N2 = N/2;
+   for (i=start;i+3<N2;i+=4)
+   {
+      __m128 a0, a1, b0, b1;
+      __m128 re, im, mre, mim;
+      __m128 X1r, X1i, X2r, X2i;
+      __m128 angle, d_angle, d2_angle;
+      __m128 angle2, d_angle2, d2_angle2;
+      __m128 mod1, mod2, avg_mod;
+      /* out[i..i+3] and out[N-i..N-i-3] */
+      a0 = _mm_loadu_ps(&out[i].r);
+      a1 = _mm_loadu_ps(&out[i+2].r);
+      b0 = _mm_loadu_ps(&out[N-i-3].r);
+      b1 = _mm_loadu_ps(&out[N-i-1].r);
+      re = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0));
+      im = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1));
+      mre = _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0));
+      mim = _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1));
+      mre = _mm_shuffle_ps(mre, mre, _MM_SHUFFLE(0, 1, 2, 3));
+      mim = _mm_shuffle_ps(mim, mim, _MM_SHUFFLE(0, 1, 2, 3));
+      X1r = _mm_add_ps(re, mre);
+      X1i = _mm_sub_ps(im, mim);
+      X2r = _mm_add_ps(im, mim);
+      X2i = _mm_sub_ps(mre, re);
+
+      angle = _mm_mul_ps(scale, fast_atan2f_sse4_1(X1i, X1r));
+      d_angle = _mm_sub_ps(angle, _mm_loadu_ps(&A[i]));
+      d2_angle = _mm_sub_ps(d_angle, _mm_loadu_ps(&dA[i]));
+
+      angle2 = _mm_mul_ps(scale, fast_atan2f_sse4_1(X2i, X2r));
+      d_angle2 = _mm_sub_ps(angle2, angle);
+      d2_angle2 = _mm_sub_ps(d_angle2, d_angle);
+
+      /* Same rounding as float2int() */
+      mod1 = _mm_sub_ps(d2_angle, _mm_cvtepi32_ps(_mm_cvtps_epi32(d2_angle)));
+      mod2 = _mm_sub_ps(d2_angle2, _mm_cvtepi32_ps(_mm_cvtps_epi32(d2_angle2)));
+      _mm_storeu_ps(&noisiness[i], _mm_add_ps(_mm_andnot_ps(signmask, mod1), _mm_andnot_ps(signmask, mod2)));
+      mod1 = _mm_mul_ps(mod1, mod1);
+      mod1 = _mm_mul_ps(mod1, mod1);
+      mod2 = _mm_mul_ps(mod2, mod2);
+      mod2 = _mm_mul_ps(mod2, mod2);
+
+      avg_mod = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(&d2A[i]), mod1), _mm_mul_ps(_mm_set1_ps(2.f), mod2));
+      avg_mod = _mm_mul_ps(_mm_set1_ps(.25f), avg_mod);
+      _mm_storeu_ps(&tonality[i], _mm_sub_ps(_mm_div_ps(one, _mm_add_ps(one, _mm_mul_ps(tscale, avg_mod))), offset));
+      _mm_storeu_ps(&tonality2[i], _mm_sub_ps(_mm_div_ps(one, _mm_add_ps(one, _mm_mul_ps(tscale, mod2))), offset));
+
+      _mm_storeu_ps(&A[i], angle2);
+      _mm_storeu_ps(&dA[i], d_angle2);
+      _mm_storeu_ps(&d2A[i], mod2);
+   }
+   tonality_bins_c(out, N, i, A, dA, d2A, tonality, tonality2, noisiness);
+}
+
+#endif
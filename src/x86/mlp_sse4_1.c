@@ -0,0 +1,185 @@
+/* Copyright (c) 2026 The opus_sm contributors */
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include "arch.h"
+#include "os_support.h"
+#include "../tansig_table.h"
+#include "../mlp.h"
+#include "x86/x86cpu.h"
+
+#if defined(OPUS_X86_MAY_HAVE_SSE4_1)
+
+/* Four consecutive int8 values (weights or biases) as floats. The last
+   vector of a layer whose size is not a multiple of 4 is loaded element by
+   element so nothing past the end of the array is read. */
+static OPUS_INLINE __m128 load_int8x4(const opus_int8 *p, int n)
+{
+   if (n >= 4) {
+      /* The rows are not aligned, OP_CVTEPI8_EPI32_M32() may not be used */
+      opus_int32 w;
+      OPUS_COPY((opus_int8 *)&w, p, 4);
+      return _mm_cvtepi32_ps(_mm_cvtepi8_epi32(_mm_cvtsi32_si128(w)));
+   }
+   return _mm_setr_ps(p[0], n > 1 ? p[1] : 0, n > 2 ? p[2] : 0, 0);
+}
+
+static OPUS_INLINE void store_partial(float *p, __m128 x, int n)
+{
+   float tmp[4];
+   int i;
+   if (n >= 4) {
+      _mm_storeu_ps(p, x);
+      return;
+   }
+   _mm_storeu_ps(tmp, x);
+   for (i=0;i<n;i++)
+      p[i] = tmp[i];
+}
+
+/* Same steps as tansig_approx() in mlp.c, for 4 values at once, so the
+   results are the same */
+static OPUS_INLINE __m128 tansig_approx4(__m128 x)
+{
+   const __m128 signmask = _mm_set1_ps(-0.f);
+   const __m128 one = _mm_set1_ps(1.f);
+   __m128 ax, sign, y, dy, fi;
+   __m128i i;
+   int idx[4];
+   /* NaN and |x| >= 8 are handled by the selects at the end, clamping them
+      here only keeps the table index in range */
+   ax = _mm_min_ps(_mm_andnot_ps(signmask, x), _mm_set1_ps(8.f));
+   sign = _mm_and_ps(_mm_cmplt_ps(x, _mm_setzero_ps()), signmask);
+   fi = _mm_floor_ps(_mm_add_ps(_mm_set1_ps(.5f), _mm_mul_ps(_mm_set1_ps(25.f), ax)));
+   i = _mm_cvttps_epi32(fi);
+   ax = _mm_sub_ps(ax, _mm_mul_ps(_mm_set1_ps(.04f), fi));
+   _mm_storeu_si128((__m128i *)idx, i);
+   y = _mm_setr_ps(tansig_table[idx[0]], tansig_table[idx[1]], tansig_table[idx[2]], tansig_table[idx[3]]);
+   dy = _mm_sub_ps(one, _mm_mul_ps(y, y));
+   y = _mm_add_ps(y, _mm_mul_ps(_mm_mul_ps(ax, dy), _mm_sub_ps(one, _mm_mul_ps(y, ax))));
+   y = _mm_or_ps(y, sign);
+   /* Tests are reversed to catch NaNs, like in tansig_approx() */
+   y = _mm_blendv_ps(_mm_set1_ps(-1.f), y, _mm_cmpgt_ps(x, _mm_set1_ps(-8.f)));
+   return _mm_blendv_ps(one, y, _mm_cmplt_ps(x, _mm_set1_ps(8.f)));
+}
+
+static OPUS_INLINE __m128 sigmoid_approx4(__m128 x)
+{
+   const __m128 half = _mm_set1_ps(.5f);
+   return _mm_add_ps(half, _mm_mul_ps(half, tansig_approx4(_mm_mul_ps(half, x))));
+}
+
+/* The weights of input j are contiguous over the neurons, so 4 neurons are
+   computed at once, each lane summing in the same order as compute_dense_c(). */
+void compute_dense_sse4_1(const DenseLayer *layer, float *output, const float *input)
+{
+   int i, j;
+   int N, M;
+   int stride;
+   const __m128 scale = _mm_set1_ps(WEIGHTS_SCALE);
+   M = layer->nb_inputs;
+   N = layer->nb_neurons;
+   stride = N;
+   for (i=0;i<N;i+=4)
+   {
+      int n = IMIN(4, N-i);
+      __m128 sum = load_int8x4(&layer->bias[i], n);
+      for (j=0;j<M;j++)
+         sum = _mm_add_ps(sum, _mm_mul_ps(load_int8x4(&layer->input_weights[j*stride + i], n), _mm_set1_ps(input[j])));
+      sum = _mm_mul_ps(scale, sum);
+      sum = layer->sigmoid ? sigmoid_approx4(sum) : tansig_approx4(sum);
+      store_partial(&output[i], sum, n);
+   }
+}
+
+void compute_gru_sse4_1(const GRULayer *gru, float *state, const float *input)
+{
+   int i, j;
+   int N, M;
+   int stride;
+   /* MAX_NEURONS is a multiple of 4, full vectors always fit */
+   float z[MAX_NEURONS];
+   float r[MAX_NEURONS];
+   float h[MAX_NEURONS];
+   const __m128 scale = _mm_set1_ps(WEIGHTS_SCALE);
+   const __m128 one = _mm_set1_ps(1.f);
+   M = gru->nb_inputs;
+   N = gru->nb_neurons;
+   stride = 3*N;
+   for (i=0;i<N;i+=4)
+   {
+      int n = IMIN(4, N-i);
+      /* Update gate, reset gate and the input part of the output */
+      __m128 zsum = load_int8x4(&gru->bias[i], n);
+      __m128 rsum = load_int8x4(&gru->bias[N + i], n);
+      __m128 hsum = load_int8x4(&gru->bias[2*N + i], n);
+      for (j=0;j<M;j++)
+      {
+         __m128 x = _mm_set1_ps(input[j]);
+         zsum = _mm_add_ps(zsum, _mm_mul_ps(load_int8x4(&gru->input_weights[j*stride + i], n), x));
+         rsum = _mm_add_ps(rsum, _mm_mul_ps(load_int8x4(&gru->input_weights[N + j*stride + i], n), x));
+         hsum = _mm_add_ps(hsum, _mm_mul_ps(load_int8x4(&gru->input_weights[2*N + j*stride + i], n), x));
+      }
+      for (j=0;j<N;j++)
+      {
+         __m128 s = _mm_set1_ps(state[j]);
+         zsum = _mm_add_ps(zsum, _mm_mul_ps(load_int8x4(&gru->recurrent_weights[j*stride + i], n), s));
+         rsum = _mm_add_ps(rsum, _mm_mul_ps(load_int8x4(&gru->recurrent_weights[N + j*stride + i], n), s));
+      }
+      _mm_storeu_ps(&z[i], sigmoid_approx4(_mm_mul_ps(scale, zsum)));
+      _mm_storeu_ps(&r[i], sigmoid_approx4(_mm_mul_ps(scale, rsum)));
+      _mm_storeu_ps(&h[i], hsum);
+   }
+   for (i=0;i<N;i+=4)
+   {
+      int n = IMIN(4, N-i);
+      /* Recurrent part of the output, which needs the whole reset gate */
+      __m128 hsum = _mm_loadu_ps(&h[i]);
+      __m128 zi, si;
+      float s[4] = {0, 0, 0, 0};
+      for (j=0;j<N;j++)
+      {
+         __m128 w = load_int8x4(&gru->recurrent_weights[2*N + j*stride + i], n);
+         hsum = _mm_add_ps(hsum, _mm_mul_ps(_mm_mul_ps(w, _mm_set1_ps(state[j])), _mm_set1_ps(r[j])));
+      }
+      zi = _mm_loadu_ps(&z[i]);
+      for (j=0;j<n;j++)
+         s[j] = state[i + j];
+      si = _mm_loadu_ps(s);
+      hsum = _mm_add_ps(_mm_mul_ps(zi, si), _mm_mul_ps(_mm_sub_ps(one, zi), tansig_approx4(_mm_mul_ps(scale, hsum))));
+      _mm_storeu_ps(&h[i], hsum);
+   }
+   for (i=0;i<N;i++)
+      state[i] = h[i];
+}
+
+#endif
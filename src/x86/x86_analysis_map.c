@@ -0,0 +1,87 @@
+/* Copyright (c) 2026 The opus_sm contributors */
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include "x86/x86cpu.h"
+#include "../mlp.h"
+#include "../analysis.h"
+
+#if defined(OPUS_HAVE_RTCD)
+
+#if defined(OPUS_X86_MAY_HAVE_SSE4_1) && !defined(OPUS_X86_PRESUME_SSE4_1)
+
+void (*const COMPUTE_DENSE_IMPL[OPUS_ARCHMASK + 1])(
+      const DenseLayer *layer,
+      float            *output,
+      const float      *input
+) = {
+  compute_dense_c,                /* non-sse */
+  compute_dense_c,
+  compute_dense_c,
+  MAY_HAVE_SSE4_1(compute_dense), /* sse4.1  */
+  MAY_HAVE_SSE4_1(compute_dense)  /* avx  */
+};
+
+void (*const COMPUTE_GRU_IMPL[OPUS_ARCHMASK + 1])(
+      const GRULayer *gru,
+      float          *state,
+      const float    *input
+) = {
+  compute_gru_c,                /* non-sse */
+  compute_gru_c,
+  compute_gru_c,
+  MAY_HAVE_SSE4_1(compute_gru), /* sse4.1  */
+  MAY_HAVE_SSE4_1(compute_gru)  /* avx  */
+};
+
+#if !defined(FIXED_POINT)
+
+void (*const TONALITY_BINS_IMPL[OPUS_ARCHMASK + 1])(
+      const kiss_fft_cpx *out,
+      int                 N,
+      int                 start,
+      float              *A,
+      float              *dA,
+      float              *d2A,
+      float              *tonality,
+      float              *tonality2,
+      float              *noisiness
+) = {
+  tonality_bins_c,                /* non-sse */
+  tonality_bins_c,
+  tonality_bins_c,
+  MAY_HAVE_SSE4_1(tonality_bins), /* sse4.1  */
+  MAY_HAVE_SSE4_1(tonality_bins)  /* avx  */
+};
+
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,306 @@
+/* Copyright (c) 2018 Xiph.Org Foundation */
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "cpu_support.h"
+#include "float_cast.h"
+#include "modes.h"
+#include "kiss_fft.h"
+#include "../src/analysis.h"
+#include "../src/mlp.h"
+
+/* The optimized versions of the analysis functions must give exactly the
+   same results as the C versions, which they are compared with here. */
+
+#define LOOPS 1000
+
+#ifndef M_PI
+#define M_PI 3.141592653
+#endif
+
+static float rand_float(float scale)
+{
+   return scale*((float)rand()/RAND_MAX - .5f);
+}
+
+static int test_tonality_bins(int arch)
+{
+   kiss_fft_cpx out[480];
+   float A[2][240], dA[2][240], d2A[2][240];
+   float tonality[2][240], tonality2[2][240], noisiness[2][240];
+   int count, i;
+   printf("Testing tonality_bins() optimization ...\n");
+   memset(A, 0, sizeof(A));
+   memset(dA, 0, sizeof(dA));
+   memset(d2A, 0, sizeof(d2A));
+   for (count=0;count<LOOPS;count++)
+   {
+      /* Large, small and very small (atan2 of 0) values */
+      float scale = (count%3 == 0) ? 1e4f : (count%3 == 1) ? 1.f : 1e-9f;
+      for (i=0;i<480;i++)
+      {
+         out[i].r = rand_float(scale);
+         out[i].i = rand_float(scale);
+      }
+      tonality_bins_c(out, 480, 1, A[0], dA[0], d2A[0], tonality[0], tonality2[0], noisiness[0]);
+      tonality_bins(out, 480, 1, A[1], dA[1], d2A[1], tonality[1], tonality2[1], noisiness[1], arch);
+      if (memcmp(&A[0][1], &A[1][1], 239*sizeof(float)) || memcmp(&dA[0][1], &dA[1][1], 239*sizeof(float))
+            || memcmp(&d2A[0][1], &d2A[1][1], 239*sizeof(float))
+            || memcmp(&tonality[0][1], &tonality[1][1], 239*sizeof(float))
+            || memcmp(&tonality2[0][1], &tonality2[1][1], 239*sizeof(float))
+            || memcmp(&noisiness[0][1], &noisiness[1][1], 239*sizeof(float)))
+      {
+         fprintf(stderr, "**Loop %4d failed!**\n", count);
+         return 1;
+      }
+   }
+   printf("tonality_bins() optimization passed\n");
+   return 0;
+}
+
+static int test_mlp(int arch)
+{
+   float input[MAX_NEURONS];
+   float out[2][MAX_NEURONS];
+   float state[2][MAX_NEURONS];
+   float probs[2][2];
+   int count, i;
+   printf("Testing compute_dense() and compute_gru() optimizations ...\n");
+   memset(state, 0, sizeof(state));
+   for (count=0;count<LOOPS;count++)
+   {
+      float scale = (count%2 == 0) ? 2.f : 50.f;
+      for (i=0;i<MAX_NEURONS;i++)
+         input[i] = rand_float(scale);
+      compute_dense_c(&layer0, out[0], input);
+      compute_gru_c(&layer1, state[0], out[0]);
+      compute_dense_c(&layer2, probs[0], state[0]);
+      compute_dense(&layer0, out[1], input, arch);
+      compute_gru(&layer1, state[1], out[1], arch);
+      compute_dense(&layer2, probs[1], state[1], arch);
+      if (memcmp(out[0], out[1], layer0.nb_neurons*sizeof(float))
+            || memcmp(state[0], state[1], layer1.nb_neurons*sizeof(float))
+            || memcmp(probs[0], probs[1], layer2.nb_neurons*sizeof(float)))
+      {
+         fprintf(stderr, "**Loop %4d failed!**\n", count);
+         return 1;
+      }
+   }
+   printf("compute_dense() and compute_gru() optimizations passed\n");
+   return 0;
+}
+
+/* The int16 input is only rounded, so it is compared with the float layer
+   on the same (dequantized) values with a tolerance. */
+static int test_mlp_int16(void)
+{
+   opus_int16 qinput[MAX_NEURONS];
+   float input[MAX_NEURONS];
+   float out[2][MAX_NEURONS];
+   int count, i;
+   printf("Testing compute_dense_int16() ...\n");
+   for (count=0;count<LOOPS;count++)
+   {
+      float scale = (count%2 == 0) ? 2.f : 50.f;
+      for (i=0;i<MAX_NEURONS;i++)
+      {
+         qinput[i] = (opus_int16)float2int(rand_float(scale)*(1<<MLP_INPUT_SHIFT));
+         input[i] = qinput[i]*(1.f/(1<<MLP_INPUT_SHIFT));
+      }
+      compute_dense_c(&layer0, out[0], input);
+      compute_dense_int16(&layer0, out[1], qinput);
+      for (i=0;i<layer0.nb_neurons;i++)
+      {
+         if (fabs(out[0][i] - out[1][i]) > 1e-4f)
+         {
+            fprintf(stderr, "**Loop %4d failed!**\n", count);
+            return 1;
+         }
+      }
+   }
+   printf("compute_dense_int16() passed\n");
+   return 0;
+}
+
+/* The MLP of run_analysis() (with the int16 features of
+   ANALYSIS_INT16_FEATURES when enabled) against the batched float MLP of
+   tonality_analysis_mlp() on the same, quantized or not, features */
+static int test_analysis_features(void)
+{
+   static float pcm[960];
+   static float mlp_features[DETECT_SIZE*MAX_NEURONS];
+   float rnn_state[MAX_NEURONS];
+   TonalityAnalysisState direct, batched;
+   TonalityAnalysisState *batch[1];
+   AnalysisInfo info[2];
+   const CELTMode *mode = tonality_analysis_mode();
+   double phase = 0;
+   int frame, i;
+   printf("Testing the analysis MLP features ...\n");
+   if (mode == NULL)
+      return 0;
+   tonality_analysis_init(&direct, 48000);
+   tonality_analysis_init(&batched, 48000);
+   batched.mlp_features = mlp_features;
+   memset(rnn_state, 0, sizeof(rnn_state));
+   batch[0] = &batched;
+   for (frame=0;frame<250;frame++)
+   {
+      /* 1 s of tones with vibrato, then 1 s of noise bursts, ... */
+      for (i=0;i<960;i++)
+      {
+         if ((frame/50)%2 == 0)
+         {
+            phase += 2*M_PI*(440 + 20*sin(frame*.3))/48000;
+            pcm[i] = (float)(.3*sin(phase) + .1*sin(3*phase));
+         } else {
+            pcm[i] = rand_float(((frame+i/240)%3 == 0) ? .3f : .01f);
+         }
+      }
+      run_analysis(&direct, mode, pcm, 960, 960, 0, -2, 1, 48000, 16, downmix_float, &info[0]);
+      run_analysis(&batched, mode, pcm, 960, 960, 0, -2, 1, 48000, 16, downmix_float, NULL);
+      tonality_analysis_mlp(batch, rnn_state, 1);
+      info[1].valid = 0;
+      tonality_get_info(&batched, &info[1], 960);
+      if (info[0].valid != info[1].valid
+            || fabs(info[0].music_prob - info[1].music_prob) > 1e-3f
+            || fabs(info[0].activity_probability - info[1].activity_probability) > 1e-3f)
+      {
+         fprintf(stderr, "**Frame %d: music %f instead of %f**\n", frame, info[0].music_prob, info[1].music_prob);
+         return 1;
+      }
+   }
+#ifdef ANALYSIS_INT16_FEATURES
+   printf("analysis with int16 MLP features passed\n");
+#else
+   printf("analysis MLP features passed\n");
+#endif
+   return 0;
+}
+
+/* In fast mode, a window with a NaN makes the windows skipped before it
+   invalid too: they must not reach the (batched) MLP with stale features */
+static int test_decimation_nan(void)
+{
+   static float pcm[960];
+   static float mlp_features[DETECT_SIZE*MAX_NEURONS];
+   float rnn_state[MAX_NEURONS];
+   TonalityAnalysisState tonal;
+   TonalityAnalysisState *batch[1];
+   AnalysisInfo info;
+   const CELTMode *mode = tonality_analysis_mode();
+   int frame, i, j;
+   int dropped = 0;
+   printf("Testing NaN input in fast mode ...\n");
+   if (mode == NULL)
+      return 0;
+   tonality_analysis_init(&tonal, 48000);
+   tonal.decimation = ANALYSIS_MAX_DECIMATION;
+   tonal.mlp_features = mlp_features;
+   memset(rnn_state, 0, sizeof(rnn_state));
+   batch[0] = &tonal;
+   for (frame=0;frame<200;frame++)
+   {
+      int skipped = tonal.skipped;
+      int pos;
+      for (i=0;i<960;i++)
+         pcm[i] = rand_float(.3f);
+      /* One NaN sample now and then, whichever window it lands in */
+      if (frame%40 == 39)
+         pcm[frame%960] = (float)sqrt(-1.);
+      run_analysis(&tonal, mode, pcm, 960, 960, 0, -2, 1, 48000, 16, downmix_float, NULL);
+      pos = (tonal.write_pos + DETECT_SIZE - 1) % DETECT_SIZE;
+      if (skipped > 0 && tonal.skipped == 0 && !tonal.info[pos].valid)
+      {
+         for (j=1;j<=skipped;j++)
+         {
+            if (tonal.info[(pos + DETECT_SIZE - j) % DETECT_SIZE].valid)
+            {
+               fprintf(stderr, "**Frame %d: skipped window %d still valid after a NaN**\n", frame, j);
+               return 1;
+            }
+         }
+         dropped++;
+      }
+      tonality_analysis_mlp(batch, rnn_state, 1);
+      info.valid = 0;
+      tonality_get_info(&tonal, &info, 960);
+      if (!(info.music_prob >= 0 && info.music_prob <= 1))
+      {
+         fprintf(stderr, "**Frame %d: music probability %f**\n", frame, info.music_prob);
+         return 1;
+      }
+   }
+   if (dropped == 0)
+   {
+      fprintf(stderr, "**No skipped window was dropped**\n");
+      return 1;
+   }
+   printf("NaN input in fast mode passed\n");
+   return 0;
+}
+
+/* Every analysis state gets the same compiled-in mode, never a copy */
+static int test_shared_mode(void)
+{
+   const CELTMode *mode;
+   int error;
+   printf("Testing tonality_analysis_mode() ...\n");
+   mode = tonality_analysis_mode();
+#ifndef CUSTOM_MODES_ONLY
+   if (mode == NULL || mode != tonality_analysis_mode()
+         || mode != opus_custom_mode_create(48000, 960, &error) || error != OPUS_OK
+         || mode != celt_static_mode(48000, 480) || celt_static_mode(44100, 960) != NULL
+         || mode->mdct.kfft[0]->nfft != 480)
+   {
+      fprintf(stderr, "**Wrong analysis mode!**\n");
+      return 1;
+   }
+#else
+   (void)error;
+   if (mode != NULL)
+   {
+      fprintf(stderr, "**Unexpected analysis mode!**\n");
+      return 1;
+   }
+#endif
+   printf("tonality_analysis_mode() passed\n");
+   return 0;
+}
+
+int main(void)
+{
+   const int arch = opus_select_arch();
+   srand(0);
+   return test_tonality_bins(arch) || test_mlp(arch) || test_mlp_int16() || test_analysis_features() || test_decimation_nan() || test_shared_mode();
+}
@@ -0,0 +1,166 @@
+/* Copyright (c) 2026 The opus_sm contributors */
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The SIMD converters are static */
+#include "../sm/opus_sm_pcm.c"
+
+#define MAX_COUNT 100
+#define GUARD -12345.f
+
+typedef void (*s16_func)(float *out, const int16_t *in, size_t count);
+typedef void (*s24_func)(float *out, const uint8_t *in, size_t count);
+
+/* Each length in its own allocation of the exact size, so that reads past
+   the end show up with a memory checker, and a guard after the output */
+static int test_s16(const char *name, s16_func convert)
+{
+   size_t count, i;
+   printf("Testing %s ...\n", name);
+   for (count=0;count<=MAX_COUNT;count++)
+   {
+      int16_t *in = (int16_t*)malloc(sizeof(int16_t)*(count + 1));
+      float *out = (float*)malloc(sizeof(float)*(count + 1));
+      for (i=0;i<count;i++)
+         in[i] = (int16_t)(rand() - RAND_MAX/2);
+      if (count >= 2)
+      {
+         in[0] = -32768;
+         in[1] = 32767;
+      }
+      out[count] = GUARD;
+      convert(out, in, count);
+      for (i=0;i<count;i++)
+      {
+         if (out[i] != (float)in[i]/32768.f)
+         {
+            fprintf(stderr, "**%s: sample %d of %d is %g instead of %g**\n",
+                    name, (int)i, (int)count, out[i], (float)in[i]/32768.f);
+            return 1;
+         }
+      }
+      if (out[count] != GUARD)
+      {
+         fprintf(stderr, "**%s: written past %d samples**\n", name, (int)count);
+         return 1;
+      }
+      free(in);
+      free(out);
+   }
+   printf("%s passed\n", name);
+   return 0;
+}
+
+static int test_s24(const char *name, s24_func convert)
+{
+   size_t count, i;
+   printf("Testing %s ...\n", name);
+   for (count=0;count<=MAX_COUNT;count++)
+   {
+      uint8_t *in = (uint8_t*)malloc(3*count + 1);
+      float *out = (float*)malloc(sizeof(float)*(count + 1));
+      for (i=0;i<3*count;i++)
+         in[i] = (uint8_t)rand();
+      if (count >= 2)
+      {
+         /* -8388608 and 8388607 */
+         in[0] = 0x00; in[1] = 0x00; in[2] = 0x80;
+         in[3] = 0xff; in[4] = 0xff; in[5] = 0x7f;
+      }
+      out[count] = GUARD;
+      convert(out, in, count);
+      for (i=0;i<count;i++)
+      {
+         int32_t v = (int32_t)(in[3*i] | (in[3*i+1] << 8) | ((uint32_t)(int8_t)in[3*i+2] << 16));
+         if (out[i] != (float)v/8388608.f)
+         {
+            fprintf(stderr, "**%s: sample %d of %d is %g instead of %g**\n",
+                    name, (int)i, (int)count, out[i], (float)v/8388608.f);
+            return 1;
+         }
+      }
+      if (out[count] != GUARD)
+      {
+         fprintf(stderr, "**%s: written past %d samples**\n", name, (int)count);
+         return 1;
+      }
+      free(in);
+      free(out);
+   }
+   printf("%s passed\n", name);
+   return 0;
+}
+
+static int test_f32(void)
+{
+   float in[MAX_COUNT];
+   float out[MAX_COUNT];
+   int i;
+   printf("Testing pcm_to_float(PCM_F32) ...\n");
+   for (i=0;i<MAX_COUNT;i++)
+      in[i] = (float)(rand() - RAND_MAX/2)/RAND_MAX;
+   pcm_to_float(out, in, PCM_F32, MAX_COUNT);
+   if (memcmp(in, out, sizeof(in)) != 0)
+   {
+      fprintf(stderr, "**pcm_to_float(PCM_F32) is not a copy**\n");
+      return 1;
+   }
+   printf("pcm_to_float(PCM_F32) passed\n");
+   return 0;
+}
+
+int main(void)
+{
+   int ret = 0;
+   srand(0);
+   ret |= test_s16("s16_to_float_c", s16_to_float_c);
+   ret |= test_s24("s24_to_float_c", s24_to_float_c);
+#ifdef PCM_X86_AVX2
+   if (have_avx2())
+   {
+      ret |= test_s16("s16_to_float_avx2", s16_to_float_avx2);
+      ret |= test_s24("s24_to_float_avx2", s24_to_float_avx2);
+   }
+#endif
+#ifdef PCM_X86_SSE2
+   ret |= test_s16("s16_to_float_sse2", s16_to_float_sse2);
+#endif
+#ifdef PCM_ARM_NEON
+   ret |= test_s16("s16_to_float_neon", s16_to_float_neon);
+   ret |= test_s24("s24_to_float_neon", s24_to_float_neon);
+#endif
+   ret |= test_s16("s16_to_float", s16_to_float);
+   ret |= test_s24("s24_to_float", s24_to_float);
+   ret |= test_f32();
+   return ret;
+}